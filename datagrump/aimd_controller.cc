@@ -0,0 +1,93 @@
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "aimd_controller.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+constexpr double AIMDController::MIN_WINDOW;
+
+AIMDController::AIMDController( const bool debug, ControllerParameters & parameters )
+  : Controller( debug ),
+    increase_( parameters.get( "increase", 1 ) ),
+    decrease_( parameters.get( "decrease", 0.5 ) ),
+    delay_threshold_( parameters.get( "delay_threshold", 50 ) * 1000 ), /* (given in ms) */
+    window_( parameters.get( "window", 10 ) ),
+    min_rtt_( 10000000 ),
+    next_sequence_number_( 0 ),
+    recovery_sequence_number_( 0 )
+{
+  if ( increase_ <= 0 or decrease_ <= 0 or decrease_ >= 1 ) {
+    throw runtime_error( "aimd needs increase > 0 and 0 < decrease < 1" );
+  }
+}
+
+unsigned int AIMDController::window_size()
+{
+  unsigned int the_window_size = window_;
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_us()
+	 << " window size is " << the_window_size << endl;
+  }
+
+  return the_window_size;
+}
+
+void AIMDController::cut_window()
+{
+  window_ = max( window_ * decrease_, MIN_WINDOW );
+  recovery_sequence_number_ = next_sequence_number_;
+}
+
+void AIMDController::datagram_was_sent( const uint64_t sequence_number,
+					const uint64_t send_timestamp,
+					const bool after_timeout )
+{
+  next_sequence_number_ = max( next_sequence_number_, sequence_number + 1 );
+
+  /* (a lone probe timeout is no congestion signal by itself: the
+     probe's ack will show whether anything was lost) */
+  if ( after_timeout and persistent_timeout() ) {
+    /* the path has stalled: start over, as TCP does */
+    window_ = MIN_WINDOW;
+    recovery_sequence_number_ = next_sequence_number_;
+  }
+
+  Controller::datagram_was_sent( sequence_number, send_timestamp, after_timeout );
+}
+
+void AIMDController::datagram_was_lost( const uint64_t sequence_number,
+					const uint64_t timestamp )
+{
+  if ( sequence_number >= recovery_sequence_number_ ) {
+    cut_window();
+  }
+
+  Controller::datagram_was_lost( sequence_number, timestamp );
+}
+
+void AIMDController::ack_received( const uint64_t sequence_number_acked,
+				   const uint64_t send_timestamp_acked,
+				   const uint64_t recv_timestamp_acked,
+				   const uint64_t timestamp_ack_received,
+				   const unsigned int datagrams_acked )
+{
+  const uint64_t rtt = rtt_sample( send_timestamp_acked, timestamp_ack_received );
+  if ( rtt ) {
+    min_rtt_.update( timestamp_ack_received, rtt );
+  }
+
+  if ( rtt > min_rtt_.best() + delay_threshold_ ) {
+    if ( sequence_number_acked >= recovery_sequence_number_ ) {
+      cut_window();
+    }
+  } else {
+    window_ += increase_ * datagrams_acked / window_;
+  }
+
+  Controller::ack_received( sequence_number_acked, send_timestamp_acked,
+			    recv_timestamp_acked, timestamp_ack_received, datagrams_acked );
+}
@@ -0,0 +1,50 @@
+#ifndef AIMD_CONTROLLER_HH
+#define AIMD_CONTROLLER_HH
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Additive increase, multiplicative decrease: grow the window by a
+   constant each RTT, and shrink it by a factor on congestion: a loss,
+   or (since the contest link queues rather than drops) an RTT too far
+   above the minimum. A stall starts over from the smallest window. */
+
+class AIMDController : public Controller
+{
+private:
+  static constexpr double MIN_WINDOW = 1;
+
+  /* settings */
+  double increase_;        /* datagrams per RTT */
+  double decrease_;        /* factor the window is cut by */
+  double delay_threshold_; /* queueing delay (us) that counts as congestion */
+
+  double window_; /* in datagrams */
+
+  WindowedMinFilter<uint64_t> min_rtt_; /* propagation delay, in us (over 10 s) */
+
+  /* cut at most once per RTT: wait for datagrams sent after the last cut */
+  uint64_t next_sequence_number_, recovery_sequence_number_;
+
+  void cut_window();
+
+public:
+  AIMDController( const bool debug, ControllerParameters & parameters );
+
+  unsigned int window_size() override;
+
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const bool after_timeout ) override;
+
+  void datagram_was_lost( const uint64_t sequence_number,
+			  const uint64_t timestamp ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const unsigned int datagrams_acked ) override;
+};
+
+#endif /* AIMD_CONTROLLER_HH */
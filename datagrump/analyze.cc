@@ -0,0 +1,307 @@
+/* analyzer for mahimahi-format link logs (e.g. /tmp/contest_uplink_log):
+   throughput, capacity utilization, 95th-percentile queueing delay
+   and power, in one pass with memory bounded by the largest delay */
+
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file_descriptor.hh"
+#include "util.hh"
+#include "delay_histogram.hh"
+
+using namespace std;
+
+/* totals over an interval of the log */
+struct Totals
+{
+  uint64_t capacity_bytes {}; /* delivery opportunities */
+  uint64_t arrived_bytes {};
+  uint64_t departed_bytes {};
+  uint64_t dropped_packets {};
+  DelayHistogram delays {};
+};
+
+/* megabits per second, given bytes over milliseconds */
+static double mbps( const uint64_t bytes, const uint64_t ms )
+{
+  return ms ? bytes * 8.0 / ms / 1000.0 : 0.0;
+}
+
+/* one pass over a link log */
+class LogAnalyzer
+{
+private:
+  uint64_t window_ms_;
+  ostream * timeseries_;
+
+  bool started_;
+  uint64_t first_time_, last_time_;
+
+  Totals overall_, window_;
+  uint64_t window_start_;
+
+  void finish_window();
+  void add_event( const uint64_t time, const char type,
+		  const uint64_t bytes, const uint64_t delay );
+
+public:
+  LogAnalyzer( const uint64_t window_ms, ostream * timeseries );
+
+  /* parse a chunk of lines (an unterminated last line, as left by
+     an interrupted link, is ignored) */
+  void parse( const char * begin, const char * const end );
+
+  /* print the summary (base_delay_ms: one-way delay outside the link) */
+  void report( ostream & out, const uint64_t base_delay_ms );
+
+  /* forbid copying LogAnalyzer objects or assigning them */
+  LogAnalyzer( const LogAnalyzer & other ) = delete;
+  const LogAnalyzer & operator=( const LogAnalyzer & other ) = delete;
+};
+
+/* parse an unsigned decimal number, advancing the cursor */
+static uint64_t parse_number( const char * & cursor, const char * const end )
+{
+  if ( cursor == end or *cursor < '0' or *cursor > '9' ) {
+    throw runtime_error( "malformed log line (expected a number)" );
+  }
+
+  uint64_t ret = 0;
+  while ( cursor != end and *cursor >= '0' and *cursor <= '9' ) {
+    ret = ret * 10 + (*cursor - '0');
+    cursor++;
+  }
+  return ret;
+}
+
+static void skip_spaces( const char * & cursor, const char * const end )
+{
+  while ( cursor != end and *cursor == ' ' ) {
+    cursor++;
+  }
+}
+
+LogAnalyzer::LogAnalyzer( const uint64_t window_ms, ostream * timeseries )
+  : window_ms_( window_ms ),
+    timeseries_( timeseries ),
+    started_( false ),
+    first_time_( 0 ),
+    last_time_( 0 ),
+    overall_(),
+    window_(),
+    window_start_( 0 )
+{
+  if ( timeseries_ ) {
+    *timeseries_ << "# time_s\tcapacity_mbps\tingress_mbps\tthroughput_mbps\tp95_queueing_delay_ms\tdrops\n";
+  }
+}
+
+void LogAnalyzer::finish_window()
+{
+  if ( timeseries_ ) {
+    *timeseries_ << fixed << setprecision( 3 )
+		 << window_start_ / 1000.0 << "\t"
+		 << mbps( window_.capacity_bytes, window_ms_ ) << "\t"
+		 << mbps( window_.arrived_bytes, window_ms_ ) << "\t"
+		 << mbps( window_.departed_bytes, window_ms_ ) << "\t"
+		 << window_.delays.percentile( 0.95 ) << "\t"
+		 << window_.dropped_packets << "\n";
+  }
+
+  window_.capacity_bytes = window_.arrived_bytes = window_.departed_bytes = 0;
+  window_.dropped_packets = 0;
+  window_.delays.clear();
+  window_start_ += window_ms_;
+}
+
+void LogAnalyzer::add_event( const uint64_t time, const char type,
+			     const uint64_t bytes, const uint64_t delay )
+{
+  if ( not started_ ) {
+    started_ = true;
+    first_time_ = window_start_ = time;
+  }
+
+  /* (tolerate slightly out-of-order lines by counting them in the current window) */
+  last_time_ = max( last_time_, time );
+
+  while ( time >= window_start_ + window_ms_ ) {
+    finish_window();
+  }
+
+  for ( Totals * totals : { &overall_, &window_ } ) {
+    switch ( type ) {
+    case '#':
+      totals->capacity_bytes += bytes;
+      break;
+    case '+':
+      totals->arrived_bytes += bytes;
+      break;
+    case '-':
+      totals->departed_bytes += bytes;
+      totals->delays.add( delay );
+      break;
+    case 'd':
+      totals->dropped_packets += bytes;
+      break;
+    }
+  }
+}
+
+void LogAnalyzer::parse( const char * cursor, const char * const end )
+{
+  while ( cursor != end ) {
+    const char * line_end = cursor;
+    while ( line_end != end and *line_end != '\n' ) {
+      line_end++;
+    }
+
+    if ( line_end == end ) {
+      break;
+    }
+
+    /* skip comments and blank lines */
+    if ( cursor != line_end and *cursor != '#' ) {
+      /* "time type bytes [delay]" (for drops, "time d packets bytes") */
+      const uint64_t time = parse_number( cursor, line_end );
+      skip_spaces( cursor, line_end );
+      if ( cursor == line_end ) {
+	throw runtime_error( "malformed log line (missing event type)" );
+      }
+      const char type = *cursor++;
+      skip_spaces( cursor, line_end );
+      const uint64_t bytes = parse_number( cursor, line_end );
+      skip_spaces( cursor, line_end );
+      const uint64_t delay = (type == '-' and cursor != line_end) ? parse_number( cursor, line_end ) : 0;
+
+      add_event( time, type, bytes, delay );
+    }
+
+    cursor = line_end + 1;
+  }
+}
+
+void LogAnalyzer::report( ostream & out, const uint64_t base_delay_ms )
+{
+  if ( not started_ ) {
+    throw runtime_error( "log contains no events" );
+  }
+
+  /* flush the partial last window */
+  if ( window_.capacity_bytes or window_.arrived_bytes or window_.departed_bytes ) {
+    finish_window();
+  }
+
+  const uint64_t duration = last_time_ - first_time_;
+  const double capacity = mbps( overall_.capacity_bytes, duration );
+  const double throughput = mbps( overall_.departed_bytes, duration );
+  const uint64_t delay = overall_.delays.percentile( 0.95 );
+  const uint64_t total_delay = delay + base_delay_ms;
+
+  out << fixed << setprecision( 2 );
+  out << "Duration: " << duration / 1000.0 << " s\n";
+  out << "Average capacity: " << capacity << " Mbits/s\n";
+  out << "Average throughput: " << throughput << " Mbits/s ("
+      << (capacity > 0 ? 100.0 * throughput / capacity : 0.0) << "% utilization)\n";
+  out << "95th percentile per-packet queueing delay: " << delay << " ms\n";
+  out << "Packets delivered: " << overall_.delays.total()
+      << ", dropped: " << overall_.dropped_packets << "\n";
+  out << "Power score (throughput / 95th percentile delay"
+      << (base_delay_ms ? " incl. " + to_string( base_delay_ms ) + " ms base delay" : "")
+      << "): ";
+  if ( total_delay ) {
+    out << throughput / (total_delay / 1000.0) << " Mbits/s^2\n";
+  } else {
+    out << "inf\n";
+  }
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [--window MS] [--timeseries FILE] [--base-delay MS] LOGFILE" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  uint64_t window_ms = 500, base_delay_ms = 0;
+  string timeseries_filename;
+
+  const option command_line_options[] = {
+    { "window",     required_argument, nullptr, 'w' },
+    { "timeseries", required_argument, nullptr, 't' },
+    { "base-delay", required_argument, nullptr, 'b' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "w:t:b:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'w':
+      window_ms = stoull( optarg );
+      break;
+    case 't':
+      timeseries_filename = optarg;
+      break;
+    case 'b':
+      base_delay_ms = stoull( optarg );
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind != 1 or window_ms == 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  unique_ptr<ofstream> timeseries;
+  if ( not timeseries_filename.empty() ) {
+    timeseries.reset( new ofstream( timeseries_filename ) );
+  }
+
+  LogAnalyzer analyzer( window_ms, timeseries.get() );
+
+  /* map the whole log and parse it in one pass */
+  FileDescriptor log( SystemCall( argv[ optind ], open( argv[ optind ], O_RDONLY ) ) );
+  struct stat log_stat;
+  SystemCall( "fstat", fstat( log.fd_num(), &log_stat ) );
+
+  if ( log_stat.st_size > 0 ) {
+    void * const mapping = mmap( nullptr, log_stat.st_size, PROT_READ, MAP_PRIVATE, log.fd_num(), 0 );
+    if ( mapping == MAP_FAILED ) {
+      throw unix_error( "mmap" );
+    }
+    madvise( mapping, log_stat.st_size, MADV_SEQUENTIAL );
+
+    const char * const contents = static_cast<const char *>( mapping );
+    analyzer.parse( contents, contents + log_stat.st_size );
+
+    SystemCall( "munmap", munmap( mapping, log_stat.st_size ) );
+  }
+
+  analyzer.report( cout, base_delay_ms );
+
+  return EXIT_SUCCESS;
+}
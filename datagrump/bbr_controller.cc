@@ -0,0 +1,319 @@
+#include <iostream>
+#include <algorithm>
+
+#include "bbr_controller.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* gains: startup doubles the delivery rate every round (2/ln 2),
+   drain undoes the queue that built, probing cycles around 1. The
+   window allows a little over one BDP while probing by default (BBR
+   uses two), plus the most datagrams one ack has covered lately, for
+   a receiver that aggregates its acks. */
+static const double STARTUP_GAIN = 2.885;
+static const double PROBE_GAINS[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+static const unsigned int PROBE_GAIN_COUNT = sizeof( PROBE_GAINS ) / sizeof( PROBE_GAINS[ 0 ] );
+
+static const uint64_t BANDWIDTH_WINDOW_ROUNDS = 10;
+static const uint64_t MIN_RTT_WINDOW_US = 10000000;
+static const uint64_t PROBE_RTT_DURATION_US = 200000;
+
+/* slack (beyond a BDP of queue) before the bandwidth estimate is called stale */
+static const uint64_t QUEUE_GUARD_US = 10000;
+
+static const double MIN_WINDOW = 4;
+static const double INITIAL_WINDOW = 10;
+
+/* datagrams whose delivery state is remembered */
+static const size_t SENT_HISTORY = 16384;
+
+BBRController::BBRController( const bool debug, ControllerParameters & parameters )
+  : Controller( debug ),
+    sent_( SENT_HISTORY ),
+    delivered_( 0 ),
+    delivered_recv_time_( 0 ),
+    delivered_send_time_( 0 ),
+    next_sequence_number_( 0 ),
+    acked_through_( 0 ),
+    bandwidth_( BANDWIDTH_WINDOW_ROUNDS ),
+    min_rtt_( MIN_RTT_WINDOW_US ),
+    min_rtt_stamp_( 0 ),
+    latest_rtt_( 0 ),
+    ack_aggregation_( BANDWIDTH_WINDOW_ROUNDS ),
+    round_count_( 0 ),
+    next_round_delivered_( 0 ),
+    round_start_( false ),
+    probe_cwnd_gain_( parameters.get( "cwnd_gain", 1.25 ) ),
+    random_( parameters.get( "seed", 1 ) ),
+    mode_( Mode::Startup ),
+    pacing_gain_( STARTUP_GAIN ),
+    cwnd_gain_( STARTUP_GAIN ),
+    window_( INITIAL_WINDOW ),
+    full_bandwidth_( 0 ),
+    full_bandwidth_rounds_( 0 ),
+    filled_pipe_( false ),
+    draining_queue_( false ),
+    cycle_index_( 0 ),
+    cycle_stamp_( 0 ),
+    probe_bandwidth_stamp_( 0 ),
+    probe_rtt_done_stamp_( 0 ),
+    probe_rtt_round_done_( false )
+{}
+
+uint64_t BBRController::in_flight() const
+{
+  return next_sequence_number_ > acked_through_ ? next_sequence_number_ - acked_through_ : 0;
+}
+
+/* bandwidth-delay product, in datagrams */
+double BBRController::bdp() const
+{
+  if ( bandwidth_.empty() or min_rtt_.empty() ) {
+    return INITIAL_WINDOW;
+  }
+
+  return bandwidth_.best() * min_rtt_.best();
+}
+
+unsigned int BBRController::window_size()
+{
+  unsigned int the_window_size = mode_ == Mode::ProbeRTT ? MIN_WINDOW : window_;
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_us()
+	 << " window size is " << the_window_size << endl;
+  }
+
+  return the_window_size;
+}
+
+double BBRController::pacing_rate()
+{
+  if ( bandwidth_.empty() ) {
+    /* no model yet: spread the window over an RTT */
+    return min_rtt_.empty() ? 0 : pacing_gain_ * window_ * 1000000.0 / max( min_rtt_.best(), uint64_t( 1 ) );
+  }
+
+  return pacing_gain_ * bandwidth_.best() * 1000000.0;
+}
+
+void BBRController::datagram_was_sent( const uint64_t sequence_number,
+				       const uint64_t send_timestamp,
+				       const bool after_timeout )
+{
+  next_sequence_number_ = max( next_sequence_number_, sequence_number + 1 );
+
+  SentDatagram & sent = sent_[ sequence_number % sent_.size() ];
+  sent.sequence_number = sequence_number;
+  sent.send_time = send_timestamp;
+  sent.delivered = delivered_;
+  sent.delivered_recv_time = delivered_recv_time_;
+  sent.delivered_send_time = delivered_send_time_;
+
+  Controller::datagram_was_sent( sequence_number, send_timestamp, after_timeout );
+}
+
+/* turn an ack into a delivery rate sample */
+void BBRController::sample_bandwidth( const SentDatagram & sent,
+				      const uint64_t recv_timestamp, const uint64_t now )
+{
+  /* (the first datagrams have nothing delivered before them to measure from) */
+  if ( sent.delivered == 0 or min_rtt_.empty() ) {
+    return;
+  }
+
+  /* the rate is limited by the slower of the sending and the receiving,
+     and the receiver's clock keeps jitter on the ack path out of it */
+  const uint64_t send_elapsed = elapsed( sent.delivered_send_time, sent.send_time );
+  const uint64_t recv_elapsed = elapsed( sent.delivered_recv_time, recv_timestamp );
+  const uint64_t interval = max( send_elapsed, recv_elapsed );
+
+  /* (intervals shorter than an RTT see too few acks to be trusted) */
+  if ( interval == 0 or interval < min_rtt_.best() ) {
+    return;
+  }
+
+  const double rate = double( delivered_ - sent.delivered ) / interval;
+
+  /* a queue of more than a BDP behind a datagram sent while cruising
+     means the link has slowed down since the max filter's best sample.
+     On cellular links, waiting out the window (ten rounds, each stretched
+     by the queue) would hold that queue for seconds, so drain it with
+     the window cut to one BDP, following the current delivery rate. */
+  if ( mode_ == Mode::ProbeBandwidth and sent.send_time >= probe_bandwidth_stamp_
+       and elapsed( sent.send_time, now ) > 2 * min_rtt_.best() + QUEUE_GUARD_US ) {
+    set_mode( Mode::Drain, now );
+    cwnd_gain_ = 1;
+    draining_queue_ = true;
+  }
+
+  if ( draining_queue_ ) {
+    bandwidth_.reset();
+  }
+
+  bandwidth_.update( round_count_, rate );
+}
+
+void BBRController::ack_received( const uint64_t sequence_number_acked,
+				  const uint64_t send_timestamp_acked,
+				  const uint64_t recv_timestamp_acked,
+				  const uint64_t timestamp_ack_received,
+				  const unsigned int datagrams_acked )
+{
+  const uint64_t now = timestamp_ack_received;
+  const uint64_t rtt = rtt_sample( send_timestamp_acked, timestamp_ack_received );
+
+  acked_through_ = max( acked_through_, sequence_number_acked + 1 );
+  delivered_ += datagrams_acked;
+
+  if ( rtt ) {
+    latest_rtt_ = rtt;
+    min_rtt_.update( now, rtt );
+    if ( min_rtt_.best() == rtt ) {
+      min_rtt_stamp_ = now;
+    }
+  }
+
+  round_start_ = false;
+  const SentDatagram & sent = sent_[ sequence_number_acked % sent_.size() ];
+  if ( sent.sequence_number == sequence_number_acked ) {
+    /* a round ends when a datagram sent after it began is delivered */
+    if ( sent.delivered >= next_round_delivered_ ) {
+      next_round_delivered_ = delivered_;
+      round_count_++;
+      round_start_ = true;
+    }
+
+    sample_bandwidth( sent, recv_timestamp_acked, now );
+  }
+
+  ack_aggregation_.update( round_count_, datagrams_acked );
+
+  delivered_recv_time_ = recv_timestamp_acked;
+  delivered_send_time_ = send_timestamp_acked;
+
+  update_mode( now );
+  update_window( datagrams_acked );
+
+  Controller::ack_received( sequence_number_acked, send_timestamp_acked,
+			    recv_timestamp_acked, timestamp_ack_received, datagrams_acked );
+}
+
+void BBRController::set_mode( const Mode mode, const uint64_t now )
+{
+  mode_ = mode;
+
+  switch ( mode ) {
+  case Mode::Startup:
+    pacing_gain_ = cwnd_gain_ = STARTUP_GAIN;
+    break;
+  case Mode::Drain:
+    pacing_gain_ = 1 / STARTUP_GAIN;
+    cwnd_gain_ = STARTUP_GAIN;
+    break;
+  case Mode::ProbeBandwidth:
+    /* start anywhere but the draining phase (so flows don't probe in lockstep) */
+    cycle_index_ = random_() % (PROBE_GAIN_COUNT - 1);
+    cycle_index_ += cycle_index_ ? 1 : 0;
+    cycle_stamp_ = probe_bandwidth_stamp_ = now;
+    pacing_gain_ = PROBE_GAINS[ cycle_index_ ];
+    cwnd_gain_ = probe_cwnd_gain_;
+    break;
+  case Mode::ProbeRTT:
+    pacing_gain_ = cwnd_gain_ = 1;
+    probe_rtt_done_stamp_ = 0;
+    break;
+  }
+
+  if ( debug_ ) {
+    cerr << "At time " << now << " BBR mode " << int( mode )
+	 << ", bandwidth " << (bandwidth_.empty() ? 0 : bandwidth_.best() * 1000000) << " datagrams/s"
+	 << ", min RTT " << (min_rtt_.empty() ? 0 : min_rtt_.best()) << " us" << endl;
+  }
+}
+
+void BBRController::update_mode( const uint64_t now )
+{
+  switch ( mode_ ) {
+  case Mode::Startup:
+    /* the pipe is full once three rounds fail to grow the bandwidth by 25%
+       (or, on a link too jittery for that, once a BDP of queue shows up) */
+    if ( latest_rtt_ > 2 * min_rtt_.best() + QUEUE_GUARD_US ) {
+      filled_pipe_ = true;
+      set_mode( Mode::Drain, now );
+    } else if ( round_start_ and not bandwidth_.empty() ) {
+      if ( bandwidth_.best() >= full_bandwidth_ * 1.25 ) {
+	full_bandwidth_ = bandwidth_.best();
+	full_bandwidth_rounds_ = 0;
+      } else if ( ++full_bandwidth_rounds_ >= 3 ) {
+	filled_pipe_ = true;
+	set_mode( Mode::Drain, now );
+      }
+    }
+    break;
+
+  case Mode::Drain:
+    if ( in_flight() <= bdp() ) {
+      draining_queue_ = false;
+      set_mode( Mode::ProbeBandwidth, now );
+    }
+    break;
+
+  case Mode::ProbeBandwidth:
+    {
+      /* each phase lasts a min RTT, but probing up waits until the extra
+	 datagrams are in flight, and draining stops once the queue is gone */
+      const bool full_length = elapsed( cycle_stamp_, now ) > min_rtt_.best();
+      bool advance = full_length;
+      if ( pacing_gain_ > 1 ) {
+	advance = full_length and in_flight() >= pacing_gain_ * bdp();
+      } else if ( pacing_gain_ < 1 ) {
+	advance = full_length or in_flight() <= bdp();
+      }
+
+      if ( advance ) {
+	cycle_index_ = (cycle_index_ + 1) % PROBE_GAIN_COUNT;
+	cycle_stamp_ = now;
+	pacing_gain_ = PROBE_GAINS[ cycle_index_ ];
+      }
+    }
+    break;
+
+  case Mode::ProbeRTT:
+    if ( probe_rtt_done_stamp_ == 0 and in_flight() <= MIN_WINDOW ) {
+      probe_rtt_done_stamp_ = now + PROBE_RTT_DURATION_US;
+      probe_rtt_round_done_ = false;
+      next_round_delivered_ = delivered_;
+    } else if ( probe_rtt_done_stamp_ ) {
+      probe_rtt_round_done_ |= round_start_;
+      if ( probe_rtt_round_done_ and now >= probe_rtt_done_stamp_ ) {
+	min_rtt_stamp_ = now;
+	set_mode( filled_pipe_ ? Mode::ProbeBandwidth : Mode::Startup, now );
+      }
+    }
+    break;
+  }
+
+  /* the min RTT hasn't been seen for a while: drain the queue to look for it */
+  if ( mode_ != Mode::ProbeRTT and now > min_rtt_stamp_ + MIN_RTT_WINDOW_US ) {
+    set_mode( Mode::ProbeRTT, now );
+  }
+}
+
+void BBRController::update_window( const unsigned int datagrams_acked )
+{
+  /* (probing up needs room for the extra datagrams, and the receiver
+     for the ones it holds before acking them) */
+  const double target = max( cwnd_gain_, pacing_gain_ ) * bdp() + 3
+    + (ack_aggregation_.empty() ? 0 : ack_aggregation_.best() - 1);
+
+  if ( filled_pipe_ ) {
+    window_ = min( window_ + datagrams_acked, target );
+  } else if ( window_ < target or delivered_ < INITIAL_WINDOW ) {
+    /* (grow like slow start until the model catches up) */
+    window_ = window_ + datagrams_acked;
+  }
+
+  window_ = max( window_, MIN_WINDOW );
+}
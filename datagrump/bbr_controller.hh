@@ -0,0 +1,110 @@
+#ifndef BBR_CONTROLLER_HH
+#define BBR_CONTROLLER_HH
+
+#include <vector>
+#include <random>
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Model-based control (after BBR): estimate the bottleneck bandwidth
+   as a windowed max of the delivery rate and the propagation delay as
+   a windowed min of the RTT, pace at a gain times the bandwidth, and
+   cap the data in flight at a gain times their product. Gains cycle
+   to probe for more bandwidth and, now and then, for a lower RTT. */
+
+class BBRController : public Controller
+{
+private:
+  enum class Mode { Startup, Drain, ProbeBandwidth, ProbeRTT };
+
+  /* the delivery state when a datagram was sent, so that its ack
+     gives a delivery rate sample */
+  struct SentDatagram
+  {
+    uint64_t sequence_number;
+    uint64_t send_time;
+    uint64_t delivered;           /* datagrams delivered by then */
+    uint64_t delivered_recv_time; /* when the last of those arrived (receiver's clock) */
+    uint64_t delivered_send_time; /* when the last of those was sent */
+
+    SentDatagram()
+      : sequence_number( -1 ), send_time( 0 ), delivered( 0 ),
+	delivered_recv_time( 0 ), delivered_send_time( 0 ) {}
+  };
+  std::vector<SentDatagram> sent_; /* ring, indexed by sequence number */
+
+  /* delivery so far */
+  uint64_t delivered_, delivered_recv_time_, delivered_send_time_;
+
+  /* datagrams in flight: everything sent after the highest acked */
+  uint64_t next_sequence_number_, acked_through_;
+
+  /* the model: datagrams per us (over 10 rounds), and us (over 10 s) */
+  WindowedMaxFilter<double> bandwidth_;
+  WindowedMinFilter<uint64_t> min_rtt_;
+  uint64_t min_rtt_stamp_; /* when the min RTT was last seen */
+  uint64_t latest_rtt_;
+
+  /* most datagrams one ack covered (over 10 rounds) */
+  WindowedMaxFilter<unsigned int> ack_aggregation_;
+
+  /* round trips, counted in deliveries */
+  uint64_t round_count_, next_round_delivered_;
+  bool round_start_;
+
+  /* settings */
+  double probe_cwnd_gain_; /* window, in BDPs, while probing */
+
+  /* where each probing cycle starts (seeded from the settings,
+     so that a run can be repeated exactly) */
+  std::mt19937 random_;
+
+  Mode mode_;
+  double pacing_gain_, cwnd_gain_;
+  double window_; /* in datagrams */
+
+  /* startup ends when the bandwidth stops growing */
+  double full_bandwidth_;
+  unsigned int full_bandwidth_rounds_;
+  bool filled_pipe_;
+
+  /* draining a queue that built up while cruising */
+  bool draining_queue_;
+
+  /* position in the probe-bandwidth gain cycle */
+  unsigned int cycle_index_;
+  uint64_t cycle_stamp_;
+  uint64_t probe_bandwidth_stamp_; /* when probing (cruising) began */
+
+  /* probe RTT: hold a small window for a while and a round trip */
+  uint64_t probe_rtt_done_stamp_;
+  bool probe_rtt_round_done_;
+
+  uint64_t in_flight() const;
+  double bdp() const;
+
+  void sample_bandwidth( const SentDatagram & sent,
+			 const uint64_t recv_timestamp, const uint64_t now );
+  void update_mode( const uint64_t now );
+  void set_mode( const Mode mode, const uint64_t now );
+  void update_window( const unsigned int datagrams_acked );
+
+public:
+  BBRController( const bool debug, ControllerParameters & parameters );
+
+  unsigned int window_size() override;
+  double pacing_rate() override;
+
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const bool after_timeout ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const unsigned int datagrams_acked ) override;
+};
+
+#endif /* BBR_CONTROLLER_HH */
@@ -0,0 +1,624 @@
+/* benchmarks for the sourdough I/O primitives and the contest messages:
+   what each operation costs (ns, allocations and syscalls per op), and
+   loopback throughput, as one tab-separated line per benchmark */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <new>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "socket.hh"
+#include "ring_buffer.hh"
+#include "packet_pool.hh"
+#include "poller.hh"
+#include "timestamp.hh"
+#include "contest_message.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* every allocation the program makes (from any thread), counted by
+   replacing the global operator new (kept out of line, so the compiler
+   doesn't see the malloc and free inside paired with new and delete) */
+static atomic<uint64_t> allocations( 0 );
+
+__attribute__(( noinline )) void * operator new( size_t size )
+{
+  allocations.fetch_add( 1, memory_order_relaxed );
+
+  void * const ret = malloc( size ? size : 1 );
+  if ( not ret ) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+__attribute__(( noinline )) void operator delete( void * pointer ) noexcept
+{
+  free( pointer );
+}
+
+/* what a benchmark did, in its timed sections */
+struct Measurement
+{
+  uint64_t ops {}, ns {}, allocations {}, syscalls {}, bytes {};
+};
+
+/* times the sections of a benchmark that count, along with the
+   allocations made and the I/O syscalls its file descriptors made
+   (as FileDescriptor counts them: each read or write) in them */
+class Stopwatch
+{
+private:
+  vector<const FileDescriptor *> fds_;
+  Measurement measurement_;
+
+  uint64_t start_time_, start_allocations_, start_syscalls_;
+
+  uint64_t syscalls() const
+  {
+    uint64_t ret = 0;
+    for ( const auto fd : fds_ ) {
+      ret += fd->read_count() + fd->write_count();
+    }
+    return ret;
+  }
+
+public:
+  Stopwatch( const vector<const FileDescriptor *> & fds = {} )
+    : fds_( fds ), measurement_(), start_time_( 0 ), start_allocations_( 0 ), start_syscalls_( 0 ) {}
+
+  void start()
+  {
+    start_syscalls_ = syscalls();
+    start_allocations_ = allocations.load( memory_order_relaxed );
+    start_time_ = timestamp_ns();
+  }
+
+  /* end a timed section of ops operations (carrying bytes) */
+  void stop( const uint64_t ops, const uint64_t bytes = 0 )
+  {
+    measurement_.ns += timestamp_ns() - start_time_;
+    measurement_.allocations += allocations.load( memory_order_relaxed ) - start_allocations_;
+    measurement_.syscalls += syscalls() - start_syscalls_;
+    measurement_.ops += ops;
+    measurement_.bytes += bytes;
+  }
+
+  /* count syscalls made outside the file descriptors (e.g. a poller's wait) */
+  void add_syscalls( const uint64_t syscalls ) { measurement_.syscalls += syscalls; }
+
+  uint64_t elapsed() const { return measurement_.ns; }
+  const Measurement & measurement() const { return measurement_; }
+};
+
+/* ops per timed section of the microbenchmarks (enough that reading the
+   clock is lost in the noise, few enough to fit in a socket buffer) */
+static const unsigned int CHUNK = 64;
+
+/* datagrams as the contest sends them */
+static const size_t DATAGRAM_SIZE = ContestMessage::Header::WIRE_SIZE + 1424;
+
+/* two UDP sockets on loopback, the first connected to the second */
+struct UDPPair
+{
+  UDPSocket sender {}, receiver {};
+
+  UDPPair()
+  {
+    receiver.bind( Address( "::1", 0 ) );
+    sender.connect( receiver.local_address() );
+  }
+};
+
+/* a pipe, as FileDescriptors */
+struct Pipe
+{
+  FileDescriptor read_end, write_end;
+
+  Pipe() : Pipe( make_pipe() ) {}
+
+private:
+  Pipe( const array<int, 2> & fds ) : read_end( fds[ 0 ] ), write_end( fds[ 1 ] ) {}
+
+  static array<int, 2> make_pipe()
+  {
+    array<int, 2> fds;
+    SystemCall( "pipe", pipe( fds.data() ) );
+    return fds;
+  }
+};
+
+/* take whatever is waiting on a UDP socket, without blocking for more */
+static void drain( UDPSocket & socket, const size_t datagrams )
+{
+  for ( size_t received = 0; received < datagrams; ) {
+    received += socket.recv_batch( CHUNK ).size();
+  }
+}
+
+static Measurement bench_header_serialize( const uint64_t duration )
+{
+  Stopwatch watch;
+  ContestMessage::Header header( 0 );
+  char buffer[ ContestMessage::Header::WIRE_SIZE ];
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK * 16; i++ ) {
+      header.sequence_number = i;
+      header.serialize( buffer );
+      asm volatile( "" : : "r" ( buffer ) : "memory" );
+    }
+    watch.stop( CHUNK * 16 );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_header_parse( const uint64_t duration )
+{
+  Stopwatch watch;
+  const string wire = ContestMessage( 42, string( 1424, 'x' ) ).to_string();
+  uint64_t sum = 0;
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK * 16; i++ ) {
+      asm volatile( "" : : "r" ( wire.data() ) : "memory" );
+      sum += ContestMessage::Header( wire.data(), wire.size() ).sequence_number;
+    }
+    watch.stop( CHUNK * 16 );
+  }
+
+  asm volatile( "" : : "r" ( sum ) );
+  return watch.measurement();
+}
+
+static Measurement bench_message_to_string( const uint64_t duration )
+{
+  Stopwatch watch;
+  ContestMessage message( 0, string( 1424, 'x' ) );
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      message.header.sequence_number = i;
+      const string wire = message.to_string();
+      asm volatile( "" : : "r" ( wire.data() ) : "memory" );
+    }
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_message_parse( const uint64_t duration )
+{
+  Stopwatch watch;
+  const string wire = ContestMessage( 42, string( 1424, 'x' ) ).to_string();
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      const ContestMessage message( wire );
+      asm volatile( "" : : "r" ( message.payload.data() ) : "memory" );
+    }
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_view_transform_into_ack( const uint64_t duration )
+{
+  Stopwatch watch;
+  const string wire = ContestMessage( 42, string( 1424, 'x' ) ).to_string();
+  string buffer = wire;
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK * 16; i++ ) {
+      ContestMessageView view( &buffer[ 0 ], buffer.size() );
+      view.transform_into_ack( i, 12345 );
+      asm volatile( "" : : "r" ( buffer.data() ) : "memory" );
+    }
+    watch.stop( CHUNK * 16 );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_fd_write( const uint64_t duration )
+{
+  Pipe pipe;
+  Stopwatch watch( { &pipe.write_end } );
+  const string chunk( 64, 'x' );
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      pipe.write_end.write( chunk );
+    }
+    watch.stop( CHUNK, CHUNK * chunk.size() );
+
+    pipe.read_end.read( CHUNK * chunk.size() );
+  }
+
+  return watch.measurement();
+}
+
+/* reading into a new string each time, or into the caller's buffer */
+static Measurement bench_fd_read( const uint64_t duration, const bool into_buffer )
+{
+  Pipe pipe;
+  Stopwatch watch( { &pipe.read_end } );
+  const string chunk( 64, 'x' );
+  char buffer[ 64 ];
+
+  while ( watch.elapsed() < duration ) {
+    pipe.write_end.write( string( CHUNK * chunk.size(), 'x' ) );
+
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      if ( into_buffer ) {
+	pipe.read_end.read( buffer, sizeof( buffer ) );
+      } else {
+	pipe.read_end.read( chunk.size() );
+      }
+    }
+    watch.stop( CHUNK, CHUNK * chunk.size() );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_udp_send( const uint64_t duration )
+{
+  UDPPair pair;
+  Stopwatch watch( { &pair.sender } );
+  const string datagram( DATAGRAM_SIZE, 'x' );
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      pair.sender.send( datagram );
+    }
+    watch.stop( CHUNK, CHUNK * datagram.size() );
+
+    drain( pair.receiver, CHUNK );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_udp_send_batch( const uint64_t duration )
+{
+  UDPPair pair;
+  Stopwatch watch( { &pair.sender } );
+  const vector<string> datagrams( CHUNK, string( DATAGRAM_SIZE, 'x' ) );
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    pair.sender.send_batch( datagrams );
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+
+    drain( pair.receiver, CHUNK );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_udp_recv( const uint64_t duration )
+{
+  UDPPair pair;
+  Stopwatch watch( { &pair.receiver } );
+  const vector<string> datagrams( CHUNK, string( DATAGRAM_SIZE, 'x' ) );
+
+  while ( watch.elapsed() < duration ) {
+    pair.sender.send_batch( datagrams );
+
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      pair.receiver.recv();
+    }
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+  }
+
+  return watch.measurement();
+}
+
+static Measurement bench_udp_recv_batch( const uint64_t duration )
+{
+  UDPPair pair;
+  Stopwatch watch( { &pair.receiver } );
+  const vector<string> datagrams( CHUNK, string( DATAGRAM_SIZE, 'x' ) );
+
+  while ( watch.elapsed() < duration ) {
+    pair.sender.send_batch( datagrams );
+
+    watch.start();
+    size_t received = 0;
+    while ( received < CHUNK ) {
+      received += pair.receiver.recv_batch( CHUNK ).size();
+    }
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+  }
+
+  return watch.measurement();
+}
+
+/* the same, straight into buffers from a pool */
+static Measurement bench_udp_recv_batch_pool( const uint64_t duration )
+{
+  UDPPair pair;
+  PacketPool pool( CHUNK );
+  Stopwatch watch( { &pair.receiver } );
+  const vector<string> datagrams( CHUNK, string( DATAGRAM_SIZE, 'x' ) );
+
+  while ( watch.elapsed() < duration ) {
+    pair.sender.send_batch( datagrams );
+
+    watch.start();
+    size_t received = 0;
+    while ( received < CHUNK ) {
+      received += pair.receiver.recv_batch( pool, CHUNK ).size();
+    }
+    watch.stop( CHUNK, CHUNK * DATAGRAM_SIZE );
+  }
+
+  return watch.measurement();
+}
+
+/* taking a buffer from a pool and giving it back (ops are pairs) */
+static Measurement bench_pool_acquire_release( const uint64_t duration )
+{
+  PacketPool pool( CHUNK );
+  vector<PacketPool::Buffer> buffers( CHUNK );
+  Stopwatch watch;
+
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( auto & buffer : buffers ) {
+      buffer = pool.acquire();
+    }
+    for ( auto & buffer : buffers ) {
+      buffer.reset();
+    }
+    watch.stop( CHUNK, 0 );
+  }
+
+  return watch.measurement();
+}
+
+/* a poll that finds nothing ready (one wait syscall, no callbacks) */
+static Measurement bench_poll_idle( const uint64_t duration, const Poller::Backend backend )
+{
+  Pipe pipe;
+  Poller poller( backend );
+  poller.add_action( Action( pipe.read_end, Direction::In, [&] () {
+	pipe.read_end.read();
+	return ResultType::Continue;
+      } ) );
+
+  Stopwatch watch;
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      poller.poll( 0 );
+    }
+    watch.stop( CHUNK );
+    watch.add_syscalls( CHUNK );
+  }
+
+  return watch.measurement();
+}
+
+/* a poll that finds a pipe ready, whose callback reads the byte
+   waiting and writes the next one (a wait, a read and a write) */
+static Measurement bench_poll_ready( const uint64_t duration, const Poller::Backend backend )
+{
+  Pipe pipe;
+  Poller poller( backend );
+  poller.add_action( Action( pipe.read_end, Direction::In, [&] () {
+	pipe.read_end.read( 1 );
+	pipe.write_end.write( "x" );
+	return ResultType::Continue;
+      } ) );
+
+  pipe.write_end.write( "x" );
+
+  Stopwatch watch( { &pipe.read_end, &pipe.write_end } );
+  while ( watch.elapsed() < duration ) {
+    watch.start();
+    for ( unsigned int i = 0; i < CHUNK; i++ ) {
+      poller.poll( 0 );
+    }
+    watch.stop( CHUNK );
+    watch.add_syscalls( CHUNK );
+  }
+
+  return watch.measurement();
+}
+
+/* datagrams through loopback: one thread sends in batches as fast as
+   it can, this one receives (ops are datagrams received; any the
+   kernel drops are not counted) */
+static Measurement bench_udp_loopback( const uint64_t duration )
+{
+  UDPPair pair;
+  Stopwatch watch( { &pair.sender, &pair.receiver } );
+  atomic<bool> stopping( false );
+
+  watch.start();
+  const uint64_t start = timestamp_ns();
+
+  thread sender( [&] () {
+      const vector<string> datagrams( CHUNK, string( DATAGRAM_SIZE, 'x' ) );
+      while ( not stopping.load( memory_order_relaxed ) ) {
+	pair.sender.send_batch( datagrams );
+      }
+    } );
+
+  uint64_t received = 0;
+  while ( timestamp_ns() - start < duration ) {
+    received += pair.receiver.recv_batch( CHUNK ).size();
+  }
+
+  /* (the sender's counts are only safe to read once it has finished) */
+  stopping = true;
+  sender.join();
+  watch.stop( received, received * DATAGRAM_SIZE );
+
+  return watch.measurement();
+}
+
+/* bytes through a loopback TCP connection: one thread writes 64 KB
+   at a time, this one reads, into a new string each time or into a
+   ring buffer (ops are reads) */
+static Measurement bench_tcp_loopback( const uint64_t duration, const bool ring )
+{
+  TCPSocket listener;
+  listener.bind( Address( "::1", 0 ) );
+  listener.listen();
+
+  atomic<bool> stopping( false );
+  atomic<uint64_t> writes( 0 );
+
+  thread writer( [&] () {
+      TCPSocket socket;
+      socket.connect( listener.local_address() );
+      const string chunk( 65536, 'x' );
+      while ( not stopping.load( memory_order_relaxed ) ) {
+	socket.write( chunk );
+      }
+      writes = socket.write_count();
+    } );
+
+  TCPSocket reader = listener.accept();
+  RingBuffer buffer( 1024 * 1024 );
+  Stopwatch watch( { &reader } );
+
+  uint64_t bytes = 0, reads = 0;
+  watch.start();
+  const uint64_t start = timestamp_ns();
+  while ( timestamp_ns() - start < duration ) {
+    if ( ring ) {
+      bytes += buffer.read_from( reader );
+      buffer.clear();
+    } else {
+      bytes += reader.read().size();
+    }
+    reads++;
+  }
+  watch.stop( reads, bytes );
+
+  /* let the writer finish (it may be blocked writing) */
+  stopping = true;
+  while ( not reader.eof() ) {
+    reader.read();
+  }
+  writer.join();
+  watch.add_syscalls( writes );
+
+  return watch.measurement();
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " [--time MS] [--filter SUBSTRING]" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  uint64_t duration = 200; /* per benchmark, in milliseconds */
+  string filter;
+
+  const option command_line_options[] = {
+    { "time",   required_argument, nullptr, 't' },
+    { "filter", required_argument, nullptr, 'f' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "t:f:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 't':
+      duration = stoull( optarg );
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( optind != argc or duration == 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  const vector<pair<string, function<Measurement( const uint64_t )>>> benchmarks = {
+    { "header_serialize", bench_header_serialize },
+    { "header_parse", bench_header_parse },
+    { "message_to_string", bench_message_to_string },
+    { "message_parse", bench_message_parse },
+    { "view_transform_into_ack", bench_view_transform_into_ack },
+    { "fd_write_64", bench_fd_write },
+    { "fd_read_64", [] ( const uint64_t d ) { return bench_fd_read( d, false ); } },
+    { "fd_read_into_64", [] ( const uint64_t d ) { return bench_fd_read( d, true ); } },
+    { "udp_send", bench_udp_send },
+    { "udp_send_batch", bench_udp_send_batch },
+    { "udp_recv", bench_udp_recv },
+    { "udp_recv_batch", bench_udp_recv_batch },
+    { "udp_recv_batch_pool", bench_udp_recv_batch_pool },
+    { "pool_acquire_release", bench_pool_acquire_release },
+    { "poll_idle", [] ( const uint64_t d ) { return bench_poll_idle( d, Poller::Backend::Poll ); } },
+    { "epoll_idle", [] ( const uint64_t d ) { return bench_poll_idle( d, Poller::Backend::Epoll ); } },
+    { "poll_ready", [] ( const uint64_t d ) { return bench_poll_ready( d, Poller::Backend::Poll ); } },
+    { "epoll_ready", [] ( const uint64_t d ) { return bench_poll_ready( d, Poller::Backend::Epoll ); } },
+    { "udp_loopback", bench_udp_loopback },
+    { "tcp_loopback", [] ( const uint64_t d ) { return bench_tcp_loopback( d, false ); } },
+    { "tcp_loopback_ring", [] ( const uint64_t d ) { return bench_tcp_loopback( d, true ); } },
+  };
+
+  cout << "# benchmark\tops\tns_per_op\tallocs_per_op\tsyscalls_per_op\tops_per_s\tmbytes_per_s" << endl;
+
+  for ( const auto & benchmark : benchmarks ) {
+    if ( benchmark.first.find( filter ) == string::npos ) {
+      continue;
+    }
+
+    const Measurement m = benchmark.second( duration * 1000000 );
+    const double ops = max( m.ops, uint64_t( 1 ) );
+
+    cout << benchmark.first << "\t" << m.ops << fixed << setprecision( 2 )
+	 << "\t" << m.ns / ops
+	 << "\t" << m.allocations / ops
+	 << "\t" << m.syscalls / ops
+	 << "\t" << setprecision( 0 ) << (m.ns ? m.ops * 1e9 / m.ns : 0.0)
+	 << "\t" << setprecision( 2 ) << (m.ns ? m.bytes * 1e3 / m.ns : 0.0) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
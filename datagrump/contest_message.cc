@@ -1,68 +1,124 @@
 #include <stdexcept>
+#include <cstring>
 
 #include "contest_message.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
+const size_t ContestMessage::Header::WIRE_SIZE;
+
 /* helper to get the nth uint64_t field (in network byte order) */
-uint64_t get_header_field( const size_t n, const string & str )
+uint64_t get_header_field( const size_t n, const char * data, const size_t length )
 {
-  if ( str.size() < (n + 1) * sizeof( uint64_t ) ) {
+  if ( length < (n + 1) * sizeof( uint64_t ) ) {
     throw runtime_error( "contest message too small to contain header" );
   }
 
-  const uint64_t * const data_ptr
-    = reinterpret_cast<const uint64_t *>( str.data() ) + n;
+  uint64_t network_order;
+  memcpy( &network_order, data + n * sizeof( uint64_t ), sizeof( network_order ) );
+
+  return be64toh( network_order );
+}
+
+/* Timestamps go on the wire as microseconds with the top bit set.
+   Senders and receivers from before that used milliseconds, which never
+   come near the top bit, so each timestamp says which it is. A message
+   is answered in the resolution its send timestamp came in, so an old
+   sender still gets milliseconds back. */
+static const uint64_t HIGH_RESOLUTION_FLAG = uint64_t( 1 ) << 63;
+
+/* A datagram's send timestamp (in microseconds) carries ack_now in
+   the next bit down, which a timestamp never reaches either */
+static const uint64_t ACK_NOW_FLAG = uint64_t( 1 ) << 62;
+
+/* (an unset timestamp stays unset) */
+static const uint64_t NO_TIMESTAMP = -1;
+
+static uint64_t decode_timestamp( const uint64_t wire )
+{
+  if ( wire == NO_TIMESTAMP ) {
+    return NO_TIMESTAMP;
+  }
+
+  return wire & HIGH_RESOLUTION_FLAG ? wire & ~(HIGH_RESOLUTION_FLAG | ACK_NOW_FLAG) : wire * 1000;
+}
+
+static uint64_t encode_timestamp( const uint64_t timestamp, const bool high_resolution )
+{
+  if ( timestamp == NO_TIMESTAMP ) {
+    return NO_TIMESTAMP;
+  }
 
-  return be64toh( *data_ptr );
+  return high_resolution ? timestamp | HIGH_RESOLUTION_FLAG : timestamp / 1000;
 }
 
 /* Parse header from wire */
+ContestMessage::Header::Header( const char * data, const size_t length )
+  : sequence_number( get_header_field( 0, data, length ) ),
+    send_timestamp( decode_timestamp( get_header_field( 1, data, length ) ) ),
+    ack_sequence_number( get_header_field( 2, data, length ) ),
+    ack_send_timestamp( decode_timestamp( get_header_field( 3, data, length ) ) ),
+    ack_recv_timestamp( decode_timestamp( get_header_field( 4, data, length ) ) ),
+    ack_payload_length( get_header_field( 5, data, length ) ),
+    high_resolution( get_header_field( 1, data, length ) & HIGH_RESOLUTION_FLAG ),
+    ack_now( get_header_field( 1, data, length ) != NO_TIMESTAMP and high_resolution
+	     and (get_header_field( 1, data, length ) & ACK_NOW_FLAG) )
+{}
+
 ContestMessage::Header::Header( const string & str )
-  : sequence_number( get_header_field( 0, str ) ),
-    send_timestamp( get_header_field( 1, str ) ),
-    ack_sequence_number( get_header_field( 2, str ) ),
-    ack_send_timestamp( get_header_field( 3, str ) ),
-    ack_recv_timestamp( get_header_field( 4, str ) ),
-    ack_payload_length( get_header_field( 5, str ) )
+  : Header( str.data(), str.size() )
 {}
 
 /* Parse incoming message from wire */
 ContestMessage::ContestMessage( const string & str )
   : header( str ),
-    payload( str.begin() + sizeof( header ), str.end() )
+    payload( str.begin() + Header::WIRE_SIZE, str.end() )
 {}
 
 /* Fill in the send_timestamp for an outgoing message */
 void ContestMessage::set_send_timestamp()
 {
-  header.send_timestamp = timestamp_ms();
+  header.send_timestamp = timestamp_us();
+}
+
+/* helper to put the nth uint64_t field (in network byte order) */
+void put_header_field( const size_t n, const uint64_t value, char * data )
+{
+  const uint64_t network_order = htobe64( value );
+  memcpy( data + n * sizeof( uint64_t ), &network_order, sizeof( network_order ) );
 }
 
-/* helper to put a uint64_t field (in network byte order) */
-string put_header_field( const uint64_t n )
+/* Write wire representation of header into a buffer */
+void ContestMessage::Header::serialize( char * buffer ) const
 {
-  const uint64_t network_order = htobe64( n );
-  return string( reinterpret_cast<const char *>( &network_order ),
-		 sizeof( network_order ) );
+  put_header_field( 0, sequence_number, buffer );
+  put_header_field( 1, encode_timestamp( send_timestamp, high_resolution )
+		    | (ack_now and high_resolution and send_timestamp != NO_TIMESTAMP ? ACK_NOW_FLAG : 0),
+		    buffer );
+  put_header_field( 2, ack_sequence_number, buffer );
+  put_header_field( 3, encode_timestamp( ack_send_timestamp, high_resolution ), buffer );
+  put_header_field( 4, encode_timestamp( ack_recv_timestamp, high_resolution ), buffer );
+  put_header_field( 5, ack_payload_length, buffer );
 }
 
 /* Make wire representation of header */
 string ContestMessage::Header::to_string() const
 {
-  return put_header_field( sequence_number )
-    + put_header_field( send_timestamp )
-    + put_header_field( ack_sequence_number )
-    + put_header_field( ack_send_timestamp )
-    + put_header_field( ack_recv_timestamp )
-    + put_header_field( ack_payload_length );
+  string ret( WIRE_SIZE, 0 );
+  serialize( &ret[ 0 ] );
+  return ret;
 }
 
 /* Make wire representation of message */
 string ContestMessage::to_string() const
 {
-  return header.to_string() + payload;
+  string ret;
+  ret.reserve( Header::WIRE_SIZE + payload.size() );
+  ret.resize( Header::WIRE_SIZE );
+  header.serialize( &ret[ 0 ] );
+  ret.append( payload );
+  return ret;
 }
 
 /* Transform into an ack of the ContestMessage */
@@ -79,6 +135,7 @@ void ContestMessage::transform_into_ack( const uint64_t sequence_number,
   header.ack_send_timestamp = header.send_timestamp;
   header.ack_recv_timestamp = recv_timestamp;
   header.ack_payload_length = payload.length();
+  header.ack_now = false;
 
   /* delete the payload */
   payload.clear();
@@ -98,7 +155,9 @@ ContestMessage::Header::Header( const uint64_t s_sequence_number )
     ack_sequence_number( -1 ),
     ack_send_timestamp( -1 ),
     ack_recv_timestamp( -1 ),
-    ack_payload_length( -1 )
+    ack_payload_length( -1 ),
+    high_resolution( true ),
+    ack_now( false )
 {}
 
 /* Is this message an ack? */
@@ -106,3 +165,194 @@ bool ContestMessage::is_ack() const
 {
   return header.ack_sequence_number != uint64_t( -1 );
 }
+
+/* View a datagram in place */
+ContestMessageView::ContestMessageView( char * data, const size_t length )
+  : data_( data ),
+    length_( length )
+{
+  if ( length_ < ContestMessage::Header::WIRE_SIZE ) {
+    throw runtime_error( "contest message too small to contain header" );
+  }
+}
+
+ContestMessageView::ContestMessageView( string & str )
+  : ContestMessageView( &str[ 0 ], str.size() )
+{}
+
+/* Parse the header */
+ContestMessage::Header ContestMessageView::header() const
+{
+  return ContestMessage::Header( data_, length_ );
+}
+
+/* Overwrite the header */
+void ContestMessageView::set_header( const ContestMessage::Header & header )
+{
+  header.serialize( data_ );
+}
+
+/* Fill in the send_timestamp for an outgoing datagram */
+void ContestMessageView::set_send_timestamp()
+{
+  /* (in the resolution the message already uses) */
+  const bool high_resolution = get_header_field( 1, data_, length_ ) & HIGH_RESOLUTION_FLAG;
+  put_header_field( 1, encode_timestamp( timestamp_us(), high_resolution ), data_ );
+}
+
+/* Transform into an ack in place */
+void ContestMessageView::transform_into_ack( const uint64_t sequence_number,
+					     const uint64_t recv_timestamp )
+{
+  ContestMessage::Header ack = header();
+
+  /* ack the old sequence number */
+  ack.ack_sequence_number = ack.sequence_number;
+
+  /* now assign a new sequence number for the outgoing ack */
+  ack.sequence_number = sequence_number;
+
+  /* ack the other fields */
+  ack.ack_send_timestamp = ack.send_timestamp;
+  ack.ack_recv_timestamp = recv_timestamp;
+  ack.ack_payload_length = payload_length();
+  ack.ack_now = false;
+
+  set_header( ack );
+
+  /* drop the payload */
+  length_ = ContestMessage::Header::WIRE_SIZE;
+}
+
+/* Is this message an ack? */
+bool ContestMessageView::is_ack() const
+{
+  return header().ack_sequence_number != uint64_t( -1 );
+}
+
+/* Aggregated acks mark their payload, so anything else there is ignored */
+static const uint64_t ACK_RANGES_TAG = 0x41636b52616e6765; /* "AckRange" */
+
+const size_t AckRanges::MAX_RANGES;
+
+/* No datagrams yet (with room for as many runs as there can be) */
+AckRanges::AckRanges( const uint64_t max_ack_delay )
+  : ranges_(),
+    max_ack_delay_( max_ack_delay ),
+    ack_delay_( 0 )
+{
+  ranges_.reserve( MAX_RANGES );
+}
+
+AckRanges::AckRanges( const char * data, const size_t length )
+  : ranges_(),
+    max_ack_delay_( 0 ),
+    ack_delay_( 0 )
+{
+  parse( data, length );
+}
+
+/* Parse from an ack's payload: tag, max ack delay, ack delay, count, then each run */
+void AckRanges::parse( const char * data, const size_t length )
+{
+  ranges_.clear();
+  max_ack_delay_ = 0;
+  ack_delay_ = 0;
+
+  if ( length < sizeof( uint64_t ) or get_header_field( 0, data, length ) != ACK_RANGES_TAG ) {
+    return;
+  }
+
+  max_ack_delay_ = get_header_field( 1, data, length );
+  ack_delay_ = get_header_field( 2, data, length );
+
+  const uint64_t range_count = get_header_field( 3, data, length );
+  if ( range_count > MAX_RANGES ) {
+    throw runtime_error( "aggregated ack has too many ranges" );
+  }
+
+  for ( uint64_t i = 0; i < range_count; i++ ) {
+    const Range range { get_header_field( 4 + 2 * i, data, length ),
+			get_header_field( 5 + 2 * i, data, length ) };
+    if ( range.last < range.first or (not ranges_.empty() and range.first <= ranges_.back().last + 1) ) {
+      throw runtime_error( "aggregated ack has ranges out of order" );
+    }
+    ranges_.push_back( range );
+  }
+}
+
+/* Add a datagram to the runs */
+bool AckRanges::add( const uint64_t sequence_number )
+{
+  /* find the first run that ends no earlier than just before it */
+  auto it = ranges_.begin();
+  while ( it != ranges_.end() and it->last + 1 < sequence_number ) {
+    it++;
+  }
+
+  if ( it != ranges_.end() ) {
+    if ( it->first <= sequence_number and sequence_number <= it->last ) {
+      return true; /* (a duplicate) */
+    }
+
+    if ( it->last + 1 == sequence_number ) {
+      /* extend the run, joining it to the next one if that closes the gap */
+      it->last = sequence_number;
+      const auto next = it + 1;
+      if ( next != ranges_.end() and next->first == sequence_number + 1 ) {
+	it->last = next->last;
+	ranges_.erase( next );
+      }
+      return true;
+    }
+
+    if ( it->first == sequence_number + 1 ) {
+      it->first = sequence_number;
+      return true;
+    }
+  }
+
+  if ( ranges_.size() == MAX_RANGES ) {
+    return false;
+  }
+
+  ranges_.insert( it, Range { sequence_number, sequence_number } );
+  return true;
+}
+
+/* Number of datagrams covered */
+uint64_t AckRanges::count() const
+{
+  uint64_t total = 0;
+  for ( const auto & range : ranges_ ) {
+    total += range.last - range.first + 1;
+  }
+  return total;
+}
+
+/* Size of the wire representation */
+size_t AckRanges::wire_size() const
+{
+  return (4 + 2 * ranges_.size()) * sizeof( uint64_t );
+}
+
+/* Write wire representation into a buffer of wire_size() bytes */
+void AckRanges::serialize( char * buffer ) const
+{
+  put_header_field( 0, ACK_RANGES_TAG, buffer );
+  put_header_field( 1, max_ack_delay_, buffer );
+  put_header_field( 2, ack_delay_, buffer );
+  put_header_field( 3, ranges_.size(), buffer );
+  for ( size_t i = 0; i < ranges_.size(); i++ ) {
+    put_header_field( 4 + 2 * i, ranges_[ i ].first, buffer );
+    put_header_field( 5 + 2 * i, ranges_[ i ].last, buffer );
+  }
+}
+
+/* Make wire representation */
+string AckRanges::to_string() const
+{
+  string ret( wire_size(), 0 );
+  serialize( &ret[ 0 ] );
+  return ret;
+}
@@ -2,10 +2,13 @@
 #define CONTEST_MESSAGE_HH
 
 #include <string>
+#include <vector>
 #include <cstdint>
 
 struct ContestMessage
 {
+  /* (timestamps are in microseconds; on the wire, a peer that predates
+     them sends and expects milliseconds instead, see contest_message.cc) */
   struct Header {
     uint64_t sequence_number;
     uint64_t send_timestamp;
@@ -15,14 +18,28 @@ struct ContestMessage
     uint64_t ack_recv_timestamp;
     uint64_t ack_payload_length;
 
+    /* whether to put microseconds (rather than milliseconds) on the wire */
+    bool high_resolution;
+
+    /* (on a datagram) the sender's window is full with this one, so
+       nothing more is coming until it is acked: ack it right away */
+    bool ack_now;
+
+    /* Size of the header on the wire */
+    static const size_t WIRE_SIZE = 6 * sizeof( uint64_t );
+
     /* Header for new message */
     Header( const uint64_t s_sequence_number );
 
     /* Parse header from wire */
     Header( const std::string & str );
+    Header( const char * data, const size_t length );
 
     /* Make wire representation of header */
     std::string to_string() const;
+
+    /* Write wire representation into a buffer of at least WIRE_SIZE bytes */
+    void serialize( char * buffer ) const;
   } header;
 
   std::string payload;
@@ -48,4 +65,98 @@ struct ContestMessage
   bool is_ack() const;
 };
 
+/* A ContestMessage read and rewritten in place in a wire buffer,
+   without copying the payload */
+class ContestMessageView
+{
+private:
+  char * data_;
+  size_t length_;
+
+public:
+  /* View the datagram in [data, data + length) */
+  ContestMessageView( char * data, const size_t length );
+  ContestMessageView( std::string & str );
+
+  /* Parse the header */
+  ContestMessage::Header header() const;
+
+  /* Overwrite the header */
+  void set_header( const ContestMessage::Header & header );
+
+  /* Payload, still in the wire buffer */
+  const char * payload() const { return data_ + ContestMessage::Header::WIRE_SIZE; }
+  size_t payload_length() const { return length_ - ContestMessage::Header::WIRE_SIZE; }
+
+  /* Wire representation (the beginning of the original buffer) */
+  const char * data() const { return data_; }
+  size_t length() const { return length_; }
+
+  /* Fill in the send_timestamp for an outgoing datagram */
+  void set_send_timestamp();
+
+  /* Transform into an ack of the ContestMessage by rewriting the
+     header and dropping the payload (length() shrinks to the header) */
+  void transform_into_ack( const uint64_t sequence_number,
+			   const uint64_t recv_timestamp );
+
+  /* Is this message an ack? */
+  bool is_ack() const;
+};
+
+/* The datagrams an aggregated ack covers, as runs of consecutive
+   sequence numbers. They travel as the ack's payload, which a plain
+   ack doesn't have (and a sender from before ignores); the header
+   acks the newest of them, with the bytes of all of them. */
+class AckRanges
+{
+public:
+  struct Range {
+    uint64_t first, last; /* inclusive */
+  };
+
+  /* most runs one ack can carry */
+  static const size_t MAX_RANGES = 16;
+
+private:
+  std::vector<Range> ranges_; /* in order, not touching */
+  uint64_t max_ack_delay_;    /* how long the receiver may hold an ack (us) */
+  uint64_t ack_delay_;        /* how long it held this one (us) */
+
+public:
+  /* No datagrams yet */
+  AckRanges( const uint64_t max_ack_delay );
+
+  /* Parse from an ack's payload (empty for a plain ack) */
+  AckRanges( const char * data, const size_t length );
+
+  /* The same, reusing this object's storage */
+  void parse( const char * data, const size_t length );
+
+  /* Add a datagram; false (and not added) if that would take
+     more than MAX_RANGES runs */
+  bool add( const uint64_t sequence_number );
+
+  const std::vector<Range> & ranges() const { return ranges_; }
+  bool empty() const { return ranges_.empty(); }
+  void clear() { ranges_.clear(); ack_delay_ = 0; }
+
+  /* number of datagrams covered */
+  uint64_t count() const;
+
+  uint64_t max_ack_delay() const { return max_ack_delay_; }
+
+  /* how long the newest datagram waited at the receiver for the ack
+     (not part of the path's RTT) */
+  uint64_t ack_delay() const { return ack_delay_; }
+  void set_ack_delay( const uint64_t ack_delay ) { ack_delay_ = ack_delay; }
+
+  /* Make wire representation (the ack's payload) */
+  std::string to_string() const;
+
+  /* Size of the wire representation, and write it into a buffer of that size */
+  size_t wire_size() const;
+  void serialize( char * buffer ) const;
+};
+
 #endif /* CONTEST_MESSAGE_HH */
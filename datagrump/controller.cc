@@ -1,38 +1,104 @@
 #include <iostream>
+#include <stdexcept>
 
 #include "controller.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
+ControllerParameters::ControllerParameters( const string & settings )
+  : values_(), used_()
+{
+  size_t start = 0;
+  while ( start < settings.size() ) {
+    size_t end = settings.find( ',', start );
+    if ( end == string::npos ) {
+      end = settings.size();
+    }
+
+    const string setting = settings.substr( start, end - start );
+    const size_t equals = setting.find( '=' );
+    if ( equals == 0 or equals == string::npos ) {
+      throw runtime_error( "controller parameter \"" + setting + "\" is not KEY=VALUE" );
+    }
+
+    const string key = setting.substr( 0, equals );
+    if ( not values_.emplace( key, setting.substr( equals + 1 ) ).second ) {
+      throw runtime_error( "controller parameter " + key + " given twice" );
+    }
+
+    start = end + 1;
+  }
+}
+
+double ControllerParameters::get( const string & key, const double default_value )
+{
+  used_.insert( key );
+
+  const auto it = values_.find( key );
+  if ( it == values_.end() ) {
+    return default_value;
+  }
+
+  size_t parsed = 0;
+  double value = 0;
+  try {
+    value = stod( it->second, &parsed );
+  } catch ( const logic_error & ) {
+    /* (reported below) */
+  }
+
+  if ( parsed == 0 or parsed != it->second.size() ) {
+    throw runtime_error( "controller parameter " + key + ": bad value \"" + it->second + "\"" );
+  }
+
+  return value;
+}
+
+void ControllerParameters::check_all_used() const
+{
+  for ( const auto & setting : values_ ) {
+    if ( not used_.count( setting.first ) ) {
+      throw runtime_error( "unknown controller parameter " + setting.first );
+    }
+  }
+}
+
 /* Default constructor */
 Controller::Controller( const bool debug )
-  : debug_( debug )
+  : debug_( debug ),
+    rtt_estimator_()
 {}
 
-/* Get current window size, in datagrams */
-unsigned int Controller::window_size()
-{
-  /* Default: fixed window size of 100 outstanding datagrams */
-  unsigned int the_window_size = 50;
+/* timeouts in a row that mean the path has stalled */
+static const unsigned int PERSISTENT_TIMEOUTS = 3;
 
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ms()
-	 << " window size is " << the_window_size << endl;
-  }
+/* Has nothing come back for several timeouts? */
+bool Controller::persistent_timeout() const
+{
+  /* (this timeout isn't counted until the call back here) */
+  return rtt_estimator_.backoff() + 1 >= PERSISTENT_TIMEOUTS;
+}
 
-  return the_window_size;
+/* Get current pacing rate, in datagrams per second (0: don't pace) */
+double Controller::pacing_rate()
+{
+  /* Default: send whenever the window is open */
+  return 0;
 }
 
 /* A datagram was sent */
 void Controller::datagram_was_sent( const uint64_t sequence_number,
 				    /* of the sent datagram */
 				    const uint64_t send_timestamp,
-                                    /* in milliseconds */
+                                    /* in microseconds */
 				    const bool after_timeout
 				    /* datagram was sent because of a timeout */ )
 {
-  /* Default: take no action */
+  /* Default: wait twice as long for the next timeout */
+  if ( after_timeout ) {
+    rtt_estimator_.back_off();
+  }
 
   if ( debug_ ) {
     cerr << "At time " << send_timestamp
@@ -40,30 +106,78 @@ void Controller::datagram_was_sent( const uint64_t sequence_number,
   }
 }
 
+/* The kernel reported when a datagram left */
+void Controller::datagram_was_transmitted( const uint64_t sequence_number,
+					   /* of the sent datagram */
+					   const uint64_t transmit_timestamp )
+					   /* when it left the host (sender's clock) */
+{
+  /* Default: take no action */
+
+  if ( debug_ ) {
+    cerr << "At time " << transmit_timestamp
+	 << " datagram " << sequence_number << " left the host" << endl;
+  }
+}
+
+/* A datagram was declared lost */
+void Controller::datagram_was_lost( const uint64_t sequence_number,
+				    /* of the lost datagram */
+				    const uint64_t timestamp )
+				    /* when the loss was detected */
+{
+  /* Default: take no action */
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp
+	 << " datagram " << sequence_number << " was lost" << endl;
+  }
+}
+
 /* An ack was received */
+uint64_t Controller::rtt_sample( const uint64_t send_timestamp_acked,
+				const uint64_t timestamp_ack_received )
+{
+  return elapsed( send_timestamp_acked, timestamp_ack_received );
+}
+
 void Controller::ack_received( const uint64_t sequence_number_acked,
 			       /* what sequence number was acknowledged */
 			       const uint64_t send_timestamp_acked,
 			       /* when the acknowledged datagram was sent (sender's clock) */
 			       const uint64_t recv_timestamp_acked,
 			       /* when the acknowledged datagram was received (receiver's clock)*/
-			       const uint64_t timestamp_ack_received )
+			       const uint64_t timestamp_ack_received,
                                /* when the ack was received (by sender) */
+			       const unsigned int datagrams_acked )
+			       /* how many datagrams the ack covers */
 {
-  /* Default: take no action */
+  /* Default: update the RTT statistics */
+  const uint64_t rtt = rtt_sample( send_timestamp_acked, timestamp_ack_received );
+  if ( rtt ) {
+    rtt_estimator_.sample( rtt );
+  }
 
   if ( debug_ ) {
     cerr << "At time " << timestamp_ack_received
 	 << " received ack for datagram " << sequence_number_acked
 	 << " (send @ time " << send_timestamp_acked
 	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
+	 << ", covering " << datagrams_acked
 	 << endl;
   }
 }
 
+/* The receiver may delay its acks */
+void Controller::set_max_ack_delay( const uint64_t max_ack_delay )
+{
+  rtt_estimator_.set_max_ack_delay( max_ack_delay );
+}
+
 /* How long to wait (in milliseconds) if there are no acks
    before sending one more datagram */
 unsigned int Controller::timeout_ms()
 {
-  return 1000; /* timeout of one second */
+  /* a probe timeout: a little over an RTT, doubling while nothing comes back */
+  return (rtt_estimator_.timeout() + 999) / 1000;
 }
@@ -2,41 +2,103 @@
 #define CONTROLLER_HH
 
 #include <cstdint>
+#include <string>
+#include <map>
+#include <set>
+
+#include "rtt_estimator.hh"
+
+/* key=value settings for a controller, e.g. "increase=1,decrease=0.5" */
+
+class ControllerParameters
+{
+private:
+  std::map<std::string, std::string> values_;
+  std::set<std::string> used_;
+
+public:
+  ControllerParameters( const std::string & settings );
+
+  /* the named setting, or the default if it wasn't given */
+  double get( const std::string & key, const double default_value );
+
+  /* throw if a setting was given that no controller asked for */
+  void check_all_used() const;
+};
 
 /* Congestion controller interface */
+/* (subclasses do the congestion control, and call back here
+   for the timeout and debugging output) */
 
 class Controller
 {
-private:
+protected:
   bool debug_; /* Enables debugging output */
 
-  /* Add member variables here */
+  /* RTT statistics, fed by every ack, that set the timeout */
+  RTTEstimator rtt_estimator_;
+
+  /* For a datagram sent after a timeout (before calling back here):
+     has nothing come back for several timeouts in a row? One probe
+     timeout can be an RTT spike; this is the path really stalling
+     (QUIC's "persistent congestion"). */
+  bool persistent_timeout() const;
+
+  /* The RTT an ack measured, or zero if the ack seems to have come
+     back before its datagram was sent (clock jitter; see elapsed()).
+     Every controller takes its RTT samples from here, and drops the
+     zero ones rather than let them into a min filter. */
+  static uint64_t rtt_sample( const uint64_t send_timestamp_acked,
+			      const uint64_t timestamp_ack_received );
 
 public:
   /* Public interface for the congestion controller */
-  /* You can change these if you prefer, but will need to change
-     the call site as well (in sender.cc) */
+  /* (controllers are created by name; see controller_registry.hh) */
+  /* (all timestamps are in microseconds, in timestamp_us() terms
+     except recv_timestamp_acked, which is the receiver's) */
 
   /* Default constructor */
   Controller( const bool debug );
 
+  virtual ~Controller() {}
+
   /* Get current window size, in datagrams */
-  unsigned int window_size();
+  virtual unsigned int window_size() = 0;
+
+  /* Get current pacing rate, in datagrams per second (0: don't pace) */
+  virtual double pacing_rate();
 
   /* A datagram was sent */
-  void datagram_was_sent( const uint64_t sequence_number,
-			  const uint64_t send_timestamp,
-			  const bool after_timeout );
+  virtual void datagram_was_sent( const uint64_t sequence_number,
+				  const uint64_t send_timestamp,
+				  const bool after_timeout );
+
+  /* The kernel (or NIC) reports when a datagram left
+     (only with transmit timestamps on) */
+  virtual void datagram_was_transmitted( const uint64_t sequence_number,
+					 const uint64_t transmit_timestamp );
+
+  /* A datagram was declared lost (later ones were acked, but not it) */
+  virtual void datagram_was_lost( const uint64_t sequence_number,
+				  const uint64_t timestamp );
+
+  /* An ack was received
+     (send_timestamp_acked is the transmit timestamp, if there was one;
+     an aggregated ack covers several datagrams, and the other
+     arguments are about the newest of them) */
+  virtual void ack_received( const uint64_t sequence_number_acked,
+			     const uint64_t send_timestamp_acked,
+			     const uint64_t recv_timestamp_acked,
+			     const uint64_t timestamp_ack_received,
+			     const unsigned int datagrams_acked );
 
-  /* An ack was received */
-  void ack_received( const uint64_t sequence_number_acked,
-		     const uint64_t send_timestamp_acked,
-		     const uint64_t recv_timestamp_acked,
-		     const uint64_t timestamp_ack_received );
+  /* The receiver may hold an ack this long (in microseconds) to cover
+     more datagrams with it, so the timeout allows for that too */
+  void set_max_ack_delay( const uint64_t max_ack_delay );
 
   /* How long to wait (in milliseconds) if there are no acks
-     before sending one more datagram */
-  unsigned int timeout_ms();
+     before sending one more datagram (a probe) */
+  virtual unsigned int timeout_ms();
 };
 
 #endif
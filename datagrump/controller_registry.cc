@@ -0,0 +1,52 @@
+#include <stdexcept>
+
+#include "controller_registry.hh"
+#include "fixed_controller.hh"
+#include "aimd_controller.hh"
+#include "delay_controller.hh"
+#include "bbr_controller.hh"
+
+using namespace std;
+
+/* to add a controller, subclass Controller and register it here */
+const vector<ControllerType> & controller_types()
+{
+  static const vector<ControllerType> types = {
+    { "fixed", "window=50", false,
+      [] ( const bool debug, ControllerParameters & parameters ) {
+	return new FixedController( debug, parameters ); } },
+
+    { "aimd", "increase=1,decrease=0.5,delay_threshold=50,window=10", false,
+      [] ( const bool debug, ControllerParameters & parameters ) {
+	return new AIMDController( debug, parameters ); } },
+
+    { "delay", "delta=0.5", false,
+      [] ( const bool debug, ControllerParameters & parameters ) {
+	return new DelayController( debug, parameters ); } },
+
+    { "bbr", "cwnd_gain=1.25,seed=1", true,
+      [] ( const bool debug, ControllerParameters & parameters ) {
+	return new BBRController( debug, parameters ); } },
+  };
+
+  return types;
+}
+
+const ControllerType & find_controller_type( const string & name )
+{
+  for ( const auto & type : controller_types() ) {
+    if ( type.name == name ) {
+      return type;
+    }
+  }
+
+  throw runtime_error( "unknown controller " + name );
+}
+
+unique_ptr<Controller> ControllerType::make( const string & settings, const bool debug ) const
+{
+  ControllerParameters parameters( settings );
+  unique_ptr<Controller> controller( create( debug, parameters ) );
+  parameters.check_all_used();
+  return controller;
+}
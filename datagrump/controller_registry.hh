@@ -0,0 +1,31 @@
+#ifndef CONTROLLER_REGISTRY_HH
+#define CONTROLLER_REGISTRY_HH
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "controller.hh"
+
+/* The congestion control algorithms the sender can run, by name */
+
+struct ControllerType
+{
+  std::string name;
+  std::string parameters; /* the KEY=VALUE settings it takes (for usage) */
+  bool paced;             /* its model is a rate, so the sender must pace */
+  std::function<Controller *( const bool debug, ControllerParameters & parameters )> create;
+
+  /* create one from settings like "KEY=VALUE,KEY=VALUE"
+     (throws on a setting it doesn't take) */
+  std::unique_ptr<Controller> make( const std::string & settings, const bool debug ) const;
+};
+
+/* every registered controller, in the order usage lists them */
+const std::vector<ControllerType> & controller_types();
+
+/* look one up by name (throws if there is none) */
+const ControllerType & find_controller_type( const std::string & name );
+
+#endif /* CONTROLLER_REGISTRY_HH */
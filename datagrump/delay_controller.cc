@@ -0,0 +1,124 @@
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "delay_controller.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+constexpr double DelayController::MIN_WINDOW;
+
+DelayController::DelayController( const bool debug, ControllerParameters & parameters )
+  : Controller( debug ),
+    delta_( parameters.get( "delta", 0.5 ) ),
+    window_( 10 ),
+    smoothed_rtt_( 0 ),
+    min_rtt_( 10000000 ),
+    standing_rtt_( 1 ),
+    velocity_( 1 ),
+    direction_( 0 ),
+    same_direction_rtts_( 0 ),
+    last_direction_check_( 0 ),
+    window_at_last_check_( 0 )
+{
+  if ( delta_ <= 0 ) {
+    throw runtime_error( "delay needs delta > 0" );
+  }
+}
+
+unsigned int DelayController::window_size()
+{
+  unsigned int the_window_size = window_;
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_us()
+	 << " window size is " << the_window_size << endl;
+  }
+
+  return the_window_size;
+}
+
+double DelayController::pacing_rate()
+{
+  if ( min_rtt_.empty() ) {
+    return 0;
+  }
+
+  /* spread each window over half a (standing) RTT, as Copa does */
+  return 2 * window_ * 1000000.0 / max( standing_rtt_.best(), uint64_t( 1 ) );
+}
+
+void DelayController::datagram_was_sent( const uint64_t sequence_number,
+					 const uint64_t send_timestamp,
+					 const bool after_timeout )
+{
+  /* nothing has come back for a while: start over from a small window */
+  if ( after_timeout and persistent_timeout() ) {
+    window_ = MIN_WINDOW;
+    velocity_ = 1;
+    same_direction_rtts_ = 0;
+  }
+
+  Controller::datagram_was_sent( sequence_number, send_timestamp, after_timeout );
+}
+
+void DelayController::ack_received( const uint64_t sequence_number_acked,
+				    const uint64_t send_timestamp_acked,
+				    const uint64_t recv_timestamp_acked,
+				    const uint64_t timestamp_ack_received,
+				    const unsigned int datagrams_acked )
+{
+  const uint64_t now = timestamp_ack_received;
+  const uint64_t rtt = rtt_sample( send_timestamp_acked, timestamp_ack_received );
+
+  if ( rtt ) {
+    smoothed_rtt_ = smoothed_rtt_ ? 0.875 * smoothed_rtt_ + 0.125 * rtt : rtt;
+    min_rtt_.update( now, rtt );
+    standing_rtt_.set_window( max( smoothed_rtt_ / 2, 1.0 ) );
+    standing_rtt_.update( now, rtt );
+  }
+
+  /* compare the current rate with the target rate (in datagrams per us) */
+  const double queueing_delay = standing_rtt_.best() - min_rtt_.best();
+  const double current_rate = window_ / max( standing_rtt_.best(), uint64_t( 1 ) );
+  const double overshoot = current_rate * delta_ * queueing_delay; /* current / target */
+
+  /* (each datagram the ack covers moves the window a step) */
+  if ( overshoot <= 1 ) {
+    window_ += velocity_ * datagrams_acked / (delta_ * window_);
+  } else {
+    /* when the link has slowed down a lot, back off in proportion
+       (but by at most half the window per RTT) so the queue drains
+       within a few RTTs instead of a few dozen */
+    const double step = datagrams_acked * min( velocity_ * overshoot / (delta_ * window_), 0.5 );
+    window_ = max( window_ - step, MIN_WINDOW );
+  }
+
+  update_velocity( now );
+
+  Controller::ack_received( sequence_number_acked, send_timestamp_acked,
+			    recv_timestamp_acked, timestamp_ack_received, datagrams_acked );
+}
+
+void DelayController::update_velocity( const uint64_t now )
+{
+  if ( now < last_direction_check_ + smoothed_rtt_ ) {
+    return;
+  }
+
+  const int direction = window_ > window_at_last_check_ ? 1 : -1;
+  if ( direction == direction_ ) {
+    if ( ++same_direction_rtts_ >= 3 ) {
+      /* (but never move by more than the whole window in one RTT) */
+      velocity_ = min( 2 * velocity_, delta_ * window_ );
+    }
+  } else {
+    velocity_ = 1;
+    same_direction_rtts_ = 0;
+  }
+
+  direction_ = direction;
+  last_direction_check_ = now;
+  window_at_last_check_ = window_;
+}
@@ -0,0 +1,53 @@
+#ifndef DELAY_CONTROLLER_HH
+#define DELAY_CONTROLLER_HH
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Delay-based control (after Copa): aim for a sending rate of
+   1 / (delta * queueing delay), nudging the window towards it on
+   every ack with a velocity that grows while the direction holds */
+
+class DelayController : public Controller
+{
+private:
+  static constexpr double MIN_WINDOW = 2;
+
+  /* settings */
+  double delta_; /* the queue aimed for is about 1 / delta datagrams */
+
+  double window_; /* in datagrams */
+
+  /* RTT estimates, in microseconds */
+  double smoothed_rtt_;
+  WindowedMinFilter<uint64_t> min_rtt_;      /* propagation delay (over 10 s) */
+  WindowedMinFilter<uint64_t> standing_rtt_; /* recent RTT (over half an RTT) */
+
+  /* velocity: doubles each RTT once the window has moved in the
+     same direction for three RTTs, and resets when it turns */
+  double velocity_;
+  int direction_;
+  unsigned int same_direction_rtts_;
+  uint64_t last_direction_check_;
+  double window_at_last_check_;
+
+  void update_velocity( const uint64_t now );
+
+public:
+  DelayController( const bool debug, ControllerParameters & parameters );
+
+  unsigned int window_size() override;
+  double pacing_rate() override;
+
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const bool after_timeout ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const unsigned int datagrams_acked ) override;
+};
+
+#endif /* DELAY_CONTROLLER_HH */
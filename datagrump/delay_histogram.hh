@@ -0,0 +1,48 @@
+#ifndef DELAY_HISTOGRAM_HH
+#define DELAY_HISTOGRAM_HH
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+/* counts of per-packet delays, one bucket per millisecond */
+class DelayHistogram
+{
+private:
+  std::vector<uint64_t> counts_ {};
+  uint64_t total_ {};
+
+public:
+  void add( const uint64_t delay )
+  {
+    if ( delay >= counts_.size() ) {
+      counts_.resize( delay + 1 );
+    }
+    counts_[ delay ]++;
+    total_++;
+  }
+
+  uint64_t total() const { return total_; }
+
+  /* smallest delay that at least the given fraction of packets did not exceed */
+  uint64_t percentile( const double fraction ) const
+  {
+    const uint64_t rank = std::max( uint64_t( 1 ), uint64_t( fraction * total_ + 0.999999 ) );
+    uint64_t cumulative = 0;
+    for ( uint64_t delay = 0; delay < counts_.size(); delay++ ) {
+      cumulative += counts_[ delay ];
+      if ( cumulative >= rank ) {
+	return delay;
+      }
+    }
+    return 0;
+  }
+
+  void clear()
+  {
+    std::fill( counts_.begin(), counts_.end(), 0 );
+    total_ = 0;
+  }
+};
+
+#endif /* DELAY_HISTOGRAM_HH */
@@ -0,0 +1,101 @@
+#include <chrono>
+
+#include <fcntl.h>
+
+#include "event_trace.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+
+const string EventTrace::MAGIC = "DGTRACE1";
+
+/* how long the writer sleeps when it finds nothing to write
+   (short, so a small ring is enough) */
+static const chrono::milliseconds WRITER_IDLE( 1 );
+
+static size_t round_up_to_power_of_two( const size_t n )
+{
+  size_t ret = 1;
+  while ( ret < n ) {
+    ret *= 2;
+  }
+  return ret;
+}
+
+EventTrace::EventTrace( const string & filename, const size_t capacity )
+  : ring_( round_up_to_power_of_two( capacity ) ),
+    head_( 0 ),
+    cached_tail_( 0 ),
+    dropped_( 0 ),
+    padding_(),
+    tail_( 0 ),
+    file_( SystemCall( filename, open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ),
+    stopping_( false ),
+    writer_()
+{
+  static_assert( sizeof( TraceEvent ) == 32, "trace events are 32 bytes on disk" );
+
+  file_.write( MAGIC );
+
+  /* (started last, once everything it uses is ready) */
+  writer_ = thread( [this] () { write_loop(); } );
+}
+
+EventTrace::~EventTrace()
+{
+  stopping_.store( true, memory_order_release );
+  writer_.join();
+}
+
+bool EventTrace::flush( uint64_t & dropped_written )
+{
+  const uint64_t tail = tail_.load( memory_order_relaxed );
+  const uint64_t head = head_.load( memory_order_acquire );
+
+  /* note any events that didn't fit, where they would have been */
+  const uint64_t dropped = dropped_.load( memory_order_relaxed );
+  string chunk;
+  if ( dropped != dropped_written ) {
+    const TraceEvent note { timestamp_ns(), TraceEvent::Type::Dropped, 0,
+			    uint32_t( dropped - dropped_written ), 0, 0 };
+    chunk.append( reinterpret_cast<const char *>( &note ), sizeof( note ) );
+    dropped_written = dropped;
+  }
+
+  if ( head == tail and chunk.empty() ) {
+    return false;
+  }
+
+  /* the events between tail and head (which may wrap around the ring) */
+  const size_t mask = ring_.size() - 1;
+  for ( uint64_t start = tail; start < head; ) {
+    const uint64_t end = min( head, (start | mask) + 1 );
+    chunk.append( reinterpret_cast<const char *>( &ring_[ start & mask ] ),
+		  (end - start) * sizeof( TraceEvent ) );
+    start = end;
+  }
+
+  /* (the recorder may reuse the slots once they are copied) */
+  tail_.store( head, memory_order_release );
+
+  file_.write( chunk );
+  return true;
+}
+
+void EventTrace::write_loop()
+{
+  uint64_t dropped_written = 0;
+
+  while ( true ) {
+    const bool stopping = stopping_.load( memory_order_acquire );
+
+    if ( not flush( dropped_written ) ) {
+      if ( stopping ) {
+	return;
+      }
+
+      this_thread::sleep_for( WRITER_IDLE );
+    }
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef EVENT_TRACE_HH
+#define EVENT_TRACE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* One traced event, as recorded and as written to the trace file
+   (32 bytes, in the host's byte order) */
+struct TraceEvent
+{
+  enum class Type : uint16_t {
+    Sent,        /* sequence_number; count is 1 if sent after a timeout */
+    Transmitted, /* sequence_number; value is when it left (us) */
+    Acked,       /* sequence_number acked (the newest, if aggregated);
+		    count is datagrams covered; value is when the receiver got it (us, its clock) */
+    RTTSample,   /* sequence_number; value is the RTT (us) */
+    Lost,        /* sequence_number */
+    Timeout,     /* count is the timeout (ms) that expired */
+    Window,      /* count is the new window; value is datagrams in flight */
+    Dropped      /* count is events lost because the ring was full */
+  };
+
+  uint64_t timestamp; /* in timestamp_ns() terms (when the event loop woke up for it) */
+  Type type;
+  uint16_t flow;
+  uint32_t count;
+  uint64_t sequence_number;
+  uint64_t value;
+};
+
+/* Always-on tracing: events go into a preallocated ring without locks
+   or syscalls, and a background thread writes them out to a file. One
+   thread records (the sender's event loop); if it gets a whole ring
+   ahead of the writer, events are dropped (and counted) rather than
+   making it wait. Recording doesn't read the clock (which costs more
+   than the rest of it): the caller passes a time it already has. */
+
+class EventTrace
+{
+private:
+  std::vector<TraceEvent> ring_; /* size is a power of two */
+
+  /* the recording thread's side (kept a cache line from the writer's) */
+  std::atomic<uint64_t> head_;  /* next event to record */
+  uint64_t cached_tail_;        /* the writer's position, when last looked at */
+  std::atomic<uint64_t> dropped_;
+  char padding_[ 64 ];
+
+  /* the writer's side */
+  std::atomic<uint64_t> tail_;  /* next event to write out */
+
+  FileDescriptor file_;
+  std::atomic<bool> stopping_;
+  std::thread writer_;
+
+  /* write out whatever has been recorded; false if there was nothing */
+  bool flush( uint64_t & dropped_written );
+  void write_loop();
+
+public:
+  /* Trace to a file, holding up to capacity events (rounded up to a power
+     of two; the default, 512 KB, stays in cache, and lasts tens of ms
+     at full rate, while the writer wakes up every ms) */
+  EventTrace( const std::string & filename, const size_t capacity = 16384 );
+
+  /* write out everything recorded so far, and stop */
+  ~EventTrace();
+
+  void record( const uint64_t timestamp, const TraceEvent::Type type, const uint16_t flow,
+	       const uint32_t count, const uint64_t sequence_number, const uint64_t value )
+  {
+    const uint64_t head = head_.load( std::memory_order_relaxed );
+
+    if ( head - cached_tail_ == ring_.size() ) {
+      cached_tail_ = tail_.load( std::memory_order_acquire );
+      if ( head - cached_tail_ == ring_.size() ) {
+	dropped_.fetch_add( 1, std::memory_order_relaxed );
+	return;
+      }
+    }
+
+    ring_[ head & (ring_.size() - 1) ] = { timestamp, type, flow, count, sequence_number, value };
+    head_.store( head + 1, std::memory_order_release );
+  }
+
+  /* Magic number at the start of a trace file */
+  static const std::string MAGIC;
+
+  /* forbid copying or assigning */
+  EventTrace( const EventTrace & other ) = delete;
+  const EventTrace & operator=( const EventTrace & other ) = delete;
+};
+
+#endif /* EVENT_TRACE_HH */
@@ -0,0 +1,21 @@
+#include <iostream>
+
+#include "fixed_controller.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+FixedController::FixedController( const bool debug, ControllerParameters & parameters )
+  : Controller( debug ),
+    window_( parameters.get( "window", 50 ) )
+{}
+
+unsigned int FixedController::window_size()
+{
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_us()
+	 << " window size is " << window_ << endl;
+  }
+
+  return window_;
+}
@@ -0,0 +1,19 @@
+#ifndef FIXED_CONTROLLER_HH
+#define FIXED_CONTROLLER_HH
+
+#include "controller.hh"
+
+/* No congestion control: keep a fixed number of datagrams in flight */
+
+class FixedController : public Controller
+{
+private:
+  unsigned int window_; /* in datagrams */
+
+public:
+  FixedController( const bool debug, ControllerParameters & parameters );
+
+  unsigned int window_size() override;
+};
+
+#endif /* FIXED_CONTROLLER_HH */
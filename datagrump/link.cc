@@ -0,0 +1,223 @@
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "link.hh"
+
+using namespace std;
+
+const unsigned int Link::OPPORTUNITY_SIZE;
+
+/* read a mahimahi trace: one delivery opportunity per line, in ms */
+static vector<uint64_t> read_trace( const string & filename )
+{
+  ifstream trace( filename );
+  if ( not trace.is_open() ) {
+    throw runtime_error( filename + ": could not open trace" );
+  }
+
+  vector<uint64_t> schedule;
+  string line;
+  while ( getline( trace, line ) ) {
+    if ( line.empty() ) {
+      continue;
+    }
+
+    const uint64_t ms = stoull( line );
+    if ( (not schedule.empty()) and ms < schedule.back() ) {
+      throw runtime_error( filename + ": trace timestamps must be nondecreasing" );
+    }
+    schedule.push_back( ms );
+  }
+
+  if ( schedule.empty() ) {
+    throw runtime_error( filename + ": trace is empty" );
+  }
+
+  if ( schedule.back() == 0 ) {
+    throw runtime_error( filename + ": trace must last for nonzero time" );
+  }
+
+  return schedule;
+}
+
+Link::Link( const string & trace_filename, const uint64_t delay_ms, const bool repeat )
+  : schedule_( read_trace( trace_filename ) ),
+    repeat_( repeat ),
+    next_opportunity_( 0 ),
+    period_start_( 0 ),
+    finished_( false ),
+    delay_( delay_ms ),
+    packet_limit_( 0 ),
+    byte_limit_( 0 ),
+    queue_(),
+    queued_bytes_( 0 ),
+    in_transit_(),
+    in_transit_bytes_left_( 0 ),
+    delay_line_(),
+    log_( nullptr ),
+    capacity_bytes_( 0 ),
+    dropped_packets_( 0 )
+{}
+
+void Link::set_queue_limits( const size_t packets, const size_t bytes )
+{
+  packet_limit_ = packets;
+  byte_limit_ = bytes;
+}
+
+string Link::queue_description() const
+{
+  if ( packet_limit_ == 0 and byte_limit_ == 0 ) {
+    return "infinite";
+  }
+
+  string ret = "droptail [";
+  if ( byte_limit_ ) {
+    ret += "bytes=" + to_string( byte_limit_ );
+  }
+  if ( packet_limit_ ) {
+    ret += string( byte_limit_ ? ", " : "" ) + "packets=" + to_string( packet_limit_ );
+  }
+  return ret + "]";
+}
+
+void Link::set_log( ostream & log, const string & link_name,
+		    const string & trace_filename, const string & command_line,
+		    const uint64_t init_timestamp )
+{
+  log_ = &log;
+
+  *log_ << "# mahimahi mm-link (" << link_name << ") [" << trace_filename << "]\n"
+	<< "# command line: " << command_line << "\n"
+	<< "# queue: " << queue_description() << "\n"
+	<< "# init timestamp: " << init_timestamp << "\n"
+	<< "# base timestamp: 0\n";
+}
+
+uint64_t Link::next_opportunity_time() const
+{
+  return period_start_ + schedule_.at( next_opportunity_ );
+}
+
+/* burn the next delivery opportunity */
+void Link::use_opportunity()
+{
+  next_opportunity_++;
+
+  /* wraparound */
+  if ( next_opportunity_ == schedule_.size() ) {
+    next_opportunity_ = 0;
+    if ( repeat_ ) {
+      period_start_ += schedule_.back();
+    } else {
+      finished_ = true;
+    }
+  }
+}
+
+void Link::advance( const uint64_t now )
+{
+  while ( (not finished_) and next_opportunity_time() <= now ) {
+    const uint64_t this_delivery_time = next_opportunity_time();
+    use_opportunity();
+    capacity_bytes_ += OPPORTUNITY_SIZE;
+
+    if ( log_ ) {
+      *log_ << this_delivery_time << " # " << OPPORTUNITY_SIZE << "\n";
+    }
+
+    /* send as many bytes as the opportunity can carry, finishing
+       the packet in transit and then starting on the queue */
+    size_t bytes_left = OPPORTUNITY_SIZE;
+    while ( bytes_left > 0 ) {
+      if ( in_transit_bytes_left_ == 0 ) {
+	if ( queue_.empty() ) {
+	  break;
+	}
+
+	in_transit_ = move( queue_.front() );
+	queue_.pop();
+	queued_bytes_ -= in_transit_.size;
+	in_transit_bytes_left_ = in_transit_.size;
+      }
+
+      const size_t amount_to_send = min( bytes_left, in_transit_bytes_left_ );
+      in_transit_bytes_left_ -= amount_to_send;
+      bytes_left -= amount_to_send;
+
+      /* has the packet been fully sent? */
+      if ( in_transit_bytes_left_ == 0 ) {
+	if ( log_ ) {
+	  *log_ << this_delivery_time << " - " << in_transit_.size << " "
+		<< this_delivery_time - in_transit_.arrival_time << "\n";
+	}
+
+	delay_line_.push( make_pair( this_delivery_time + delay_, move( in_transit_ ) ) );
+      }
+    }
+  }
+}
+
+void Link::enqueue( const uint64_t now, Packet && packet )
+{
+  advance( now );
+
+  /* drop-tail */
+  if ( (packet_limit_ and queue_.size() + 1 > packet_limit_)
+       or (byte_limit_ and queued_bytes_ + packet.size > byte_limit_) ) {
+    drop( now, packet.size );
+    return;
+  }
+
+  packet.arrival_time = now;
+
+  if ( log_ ) {
+    *log_ << now << " + " << packet.size << "\n";
+  }
+
+  queued_bytes_ += packet.size;
+  queue_.push( move( packet ) );
+}
+
+void Link::drop( const uint64_t now, const size_t size )
+{
+  advance( now );
+
+  dropped_packets_++;
+
+  if ( log_ ) {
+    *log_ << now << " + " << size << "\n";
+    *log_ << now << " d 1 " << size << "\n";
+  }
+}
+
+bool Link::has_output( const uint64_t now ) const
+{
+  return (not delay_line_.empty()) and delay_line_.front().first <= now;
+}
+
+Link::Packet Link::pop_output()
+{
+  Packet ret = move( delay_line_.front().second );
+  delay_line_.pop();
+  return ret;
+}
+
+uint64_t Link::next_event_time() const
+{
+  uint64_t ret = -1;
+
+  /* the link needs attention at the next opportunity if there is
+     something to send (or, playing the trace once, to notice its end) */
+  if ( (not finished_)
+       and ((not repeat_) or in_transit_bytes_left_ or (not queue_.empty())) ) {
+    ret = next_opportunity_time();
+  }
+
+  if ( not delay_line_.empty() ) {
+    ret = min( ret, delay_line_.front().first );
+  }
+
+  return ret;
+}
@@ -0,0 +1,150 @@
+#ifndef LINK_HH
+#define LINK_HH
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <ostream>
+#include <cstdint>
+
+#include "packet_pool.hh"
+
+/* A FIFO queue that keeps its storage as it drains (a std::queue frees
+   and allocates blocks as packets go through), growing only when it
+   holds more than it ever has */
+template <typename T>
+class ReusableQueue
+{
+private:
+  std::vector<T> slots_ {};
+  size_t head_ = 0, size_ = 0;
+
+public:
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  T & front() { return slots_[ head_ ]; }
+  const T & front() const { return slots_[ head_ ]; }
+
+  void push( T && value )
+  {
+    if ( size_ == slots_.size() ) {
+      std::vector<T> grown( std::max( size_ * 2, size_t( 16 ) ) );
+      for ( size_t i = 0; i < size_; i++ ) {
+	grown[ i ] = std::move( slots_[ (head_ + i) % slots_.size() ] );
+      }
+      slots_.swap( grown );
+      head_ = 0;
+    }
+
+    slots_[ (head_ + size_) % slots_.size() ] = std::move( value );
+    size_++;
+  }
+
+  /* (leaves a default T behind, so the slot lets go of what it held) */
+  void pop()
+  {
+    slots_[ head_ ] = T();
+    head_ = (head_ + 1) % slots_.size();
+    size_--;
+  }
+};
+
+/* A trace-driven bottleneck link followed by a fixed one-way delay,
+   with the semantics of mahimahi's mm-link and mm-delay. Time is
+   passed in explicitly (in milliseconds), so the same link can be
+   driven by the wall clock or by a simulation. */
+class Link
+{
+public:
+  /* bytes that one delivery opportunity in the trace can carry
+     (an MTU-sized packet, as counted by mahimahi) */
+  static const unsigned int OPPORTUNITY_SIZE = 1504;
+
+  struct Packet
+  {
+    PacketPool::Buffer contents;
+    size_t size; /* bytes counted against the link and the queue */
+    unsigned int flow; /* opaque tag for the user of the link */
+    uint64_t arrival_time;
+
+    Packet() : contents(), size( 0 ), flow( 0 ), arrival_time( 0 ) {}
+    Packet( PacketPool::Buffer && s_contents, const size_t s_size, const unsigned int s_flow )
+      : contents( std::move( s_contents ) ), size( s_size ), flow( s_flow ), arrival_time( 0 ) {}
+  };
+
+private:
+  /* delivery opportunities (ms) within one period of the trace */
+  std::vector<uint64_t> schedule_;
+  bool repeat_;
+  size_t next_opportunity_;
+  uint64_t period_start_;
+  bool finished_;
+
+  uint64_t delay_;
+
+  /* drop-tail queue (a limit of zero means unlimited) */
+  size_t packet_limit_, byte_limit_;
+  ReusableQueue<Packet> queue_;
+  size_t queued_bytes_;
+
+  /* the packet partway through transmission (if any) */
+  Packet in_transit_;
+  size_t in_transit_bytes_left_;
+
+  /* packets through the link, waiting out the delay (release time, packet) */
+  ReusableQueue<std::pair<uint64_t, Packet>> delay_line_;
+
+  std::ostream * log_;
+
+  /* totals since the start (what the log would add up to) */
+  uint64_t capacity_bytes_, dropped_packets_;
+
+  uint64_t next_opportunity_time() const;
+  void use_opportunity();
+
+public:
+  Link( const std::string & trace_filename, const uint64_t delay_ms, const bool repeat );
+
+  /* limit the drop-tail queue (zero means unlimited) */
+  void set_queue_limits( const size_t packets, const size_t bytes );
+
+  /* describe the queue, as in a mahimahi log */
+  std::string queue_description() const;
+
+  /* log arrivals, drops, delivery opportunities and departures in mahimahi's format */
+  void set_log( std::ostream & log, const std::string & link_name,
+		const std::string & trace_filename, const std::string & command_line,
+		const uint64_t init_timestamp );
+
+  /* use every delivery opportunity up to and including time now */
+  void advance( const uint64_t now );
+
+  /* a packet arrives at the link at time now (it may be dropped) */
+  void enqueue( const uint64_t now, Packet && packet );
+
+  /* a packet of this size arrives at time now but is dropped anyway
+     (e.g. there was no buffer to hold it) */
+  void drop( const uint64_t now, const size_t size );
+
+  /* has a packet made it through the link and the delay by time now? */
+  bool has_output( const uint64_t now ) const;
+  Packet pop_output();
+
+  /* when the link next needs advance() to be called (uint64_t( -1 ) if idle) */
+  uint64_t next_event_time() const;
+
+  /* with repeat off, has the trace run out? */
+  bool finished() const { return finished_; }
+
+  /* bytes the delivery opportunities used so far could carry, and packets dropped */
+  uint64_t capacity_bytes() const { return capacity_bytes_; }
+  uint64_t dropped_packets() const { return dropped_packets_; }
+
+  /* forbid copying Link objects or assigning them */
+  Link( const Link & other ) = delete;
+  const Link & operator=( const Link & other ) = delete;
+};
+
+#endif /* LINK_HH */
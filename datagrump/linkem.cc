@@ -0,0 +1,370 @@
+/* trace-driven link emulator: relays datagrams between senders and a
+   receiver through an emulated bottleneck link and delay in each
+   direction (like running the sender inside mm-delay and mm-link) */
+
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <deque>
+#include <chrono>
+
+#include <getopt.h>
+#include <sys/prctl.h>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "timerfd.hh"
+#include "timestamp.hh"
+#include "link.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* bytes a datagram occupies on the emulated link beyond its payload:
+   IPv4 and UDP headers plus the 4-byte TUN header mahimahi counts */
+static const size_t PACKET_OVERHEAD = 20 + 8 + 4;
+
+/* datagrams the emulator can hold at once (in its queues, delay lines,
+   and receive batches); each takes a buffer from a pool of this many,
+   and any that arrive while every buffer is in use are dropped (as are
+   any bigger than a buffer, like a link with an MTU) */
+static const size_t MAX_PACKETS = 65536;
+
+/* relay between senders and the receiver, applying the links */
+class LinkEmulator
+{
+private:
+  PacketPool & pool_;
+  Link & uplink_, & downlink_;
+
+  /* senders send here, and get their acks back from here */
+  UDPSocket listen_socket_;
+  Address receiver_;
+
+  /* each sender gets its own socket towards the receiver,
+     so that the receiver's acks can find their way back */
+  struct Flow
+  {
+    Address sender;
+    UDPSocket socket;
+
+    Flow( const Address & s_sender ) : sender( s_sender ), socket() {}
+  };
+  deque<Flow> flows_;
+
+  Poller poller_;
+  TimerFD timer_;
+
+  /* a run of uplink datagrams for one flow */
+  vector<PacketPool::Buffer> batch_;
+
+  /* uplink datagrams lost because the receiver wasn't there */
+  uint64_t refused_packets_;
+
+  uint64_t now() const { return timestamp_ns() / 1000000; }
+
+  unsigned int find_flow( const Address & sender );
+  void send_batch( const unsigned int flow );
+  void deliver();
+  void schedule();
+
+public:
+  LinkEmulator( PacketPool & pool, Link & uplink, Link & downlink,
+		const string & listen_port, const Address & receiver );
+  int loop();
+};
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [--delay MS] [--queue-packets N] [--queue-bytes N] [--once]"
+       << " [--uplink-log FILE] [--downlink-log FILE]"
+       << " UPLINK_TRACE DOWNLINK_TRACE LISTEN_PORT RECEIVER_HOST RECEIVER_PORT" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  uint64_t delay = 0;
+  size_t queue_packets = 0, queue_bytes = 0;
+  bool once = false;
+  string uplink_log_filename, downlink_log_filename;
+
+  const option command_line_options[] = {
+    { "delay",         required_argument, nullptr, 'd' },
+    { "queue-packets", required_argument, nullptr, 'p' },
+    { "queue-bytes",   required_argument, nullptr, 'b' },
+    { "once",          no_argument,       nullptr, 'o' },
+    { "uplink-log",    required_argument, nullptr, 'u' },
+    { "downlink-log",  required_argument, nullptr, 'l' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "d:p:b:ou:l:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'd':
+      delay = stoull( optarg );
+      break;
+    case 'p':
+      queue_packets = stoul( optarg );
+      break;
+    case 'b':
+      queue_bytes = stoul( optarg );
+      break;
+    case 'o':
+      once = true;
+      break;
+    case 'u':
+      uplink_log_filename = optarg;
+      break;
+    case 'l':
+      downlink_log_filename = optarg;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind != 5 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  const string uplink_trace = argv[ optind ], downlink_trace = argv[ optind + 1 ];
+
+  /* (before the links, which hold its buffers) */
+  PacketPool pool( MAX_PACKETS );
+
+  Link uplink( uplink_trace, delay, not once ), downlink( downlink_trace, delay, not once );
+  uplink.set_queue_limits( queue_packets, queue_bytes );
+  downlink.set_queue_limits( queue_packets, queue_bytes );
+
+  /* timestamps in the logs count from when the emulator starts */
+  timestamp_ns();
+  const uint64_t init_timestamp = chrono::duration_cast<chrono::milliseconds>(
+    chrono::system_clock::now().time_since_epoch() ).count();
+
+  string command_line;
+  for ( int i = 0; i < argc; i++ ) {
+    command_line += string( i ? " " : "" ) + argv[ i ];
+  }
+
+  unique_ptr<ofstream> uplink_log, downlink_log;
+  if ( not uplink_log_filename.empty() ) {
+    uplink_log.reset( new ofstream( uplink_log_filename ) );
+    uplink.set_log( *uplink_log, "uplink", uplink_trace, command_line, init_timestamp );
+  }
+  if ( not downlink_log_filename.empty() ) {
+    downlink_log.reset( new ofstream( downlink_log_filename ) );
+    downlink.set_log( *downlink_log, "downlink", downlink_trace, command_line, init_timestamp );
+  }
+
+  /* wake up as close to each scheduled time as the kernel allows */
+  prctl( PR_SET_TIMERSLACK, 1UL );
+
+  LinkEmulator emulator( pool, uplink, downlink, argv[ optind + 2 ],
+			 Address( argv[ optind + 3 ], argv[ optind + 4 ] ) );
+  return emulator.loop();
+}
+
+LinkEmulator::LinkEmulator( PacketPool & pool, Link & uplink, Link & downlink,
+			    const string & listen_port, const Address & receiver )
+  : pool_( pool ),
+    uplink_( uplink ),
+    downlink_( downlink ),
+    listen_socket_(),
+    receiver_( receiver ),
+    flows_(),
+    poller_( Poller::Backend::Epoll ),
+    timer_(),
+    batch_(),
+    refused_packets_( 0 )
+{
+  listen_socket_.bind( Address( "::0", listen_port ) );
+
+  cerr << "Listening on " << listen_socket_.local_address().to_string()
+       << ", relaying to " << receiver_.to_string() << endl;
+}
+
+/* find (or start) the flow for a sender */
+unsigned int LinkEmulator::find_flow( const Address & sender )
+{
+  for ( unsigned int i = 0; i < flows_.size(); i++ ) {
+    if ( flows_[ i ].sender == sender ) {
+      return i;
+    }
+  }
+
+  flows_.emplace_back( sender );
+  const unsigned int flow = flows_.size() - 1;
+  UDPSocket & socket = flows_.back().socket;
+  socket.connect( receiver_ );
+
+  cerr << "New flow from " << sender.to_string() << endl;
+
+  /* acks from the receiver enter the downlink */
+  poller_.add_action( Action( socket, Direction::In, [this, &socket, flow] () {
+	const uint64_t arrival = now();
+	try {
+	  if ( pool_.empty() ) {
+	    downlink_.drop( arrival, socket.discard() + PACKET_OVERHEAD );
+	  } else {
+	    for ( auto & recd : socket.recv_batch( pool_ ) ) {
+	      const size_t size = recd.length + PACKET_OVERHEAD;
+	      if ( recd.truncated() ) {
+		downlink_.drop( arrival, size );
+	      } else {
+		downlink_.enqueue( arrival, Link::Packet { move( recd.payload ), size, flow } );
+	      }
+	    }
+	  }
+	} catch ( const unix_error & e ) {
+	  /* the receiver went away (the error an earlier datagram got) */
+	  if ( e.code().value() != ECONNREFUSED ) {
+	    throw;
+	  }
+	}
+	deliver();
+	return ResultType::Continue;
+      },
+      std::function<bool(void)>(),
+      /* the same, reported by the poller: take the error, and carry on
+	 (the receiver may come back, e.g. if it is restarted) */
+      [&socket] () {
+	try {
+	  socket.check_error();
+	} catch ( const unix_error & e ) {
+	  if ( e.code().value() != ECONNREFUSED ) {
+	    throw;
+	  }
+	}
+	return ResultType::Continue;
+      } ) );
+
+  return flow;
+}
+
+/* send the batch on a flow's socket to the receiver; if the receiver
+   isn't there (an earlier datagram was refused), the batch is lost, as
+   it would be beyond mm-link, and the flow carries on */
+void LinkEmulator::send_batch( const unsigned int flow )
+{
+  try {
+    flows_.at( flow ).socket.send_batch( batch_ );
+  } catch ( const unix_error & e ) {
+    if ( e.code().value() != ECONNREFUSED ) {
+      throw;
+    }
+
+    refused_packets_ += batch_.size();
+    cerr << "Receiver refused flow " << flow << ": dropped " << batch_.size()
+	 << " datagrams (" << refused_packets_ << " in all)" << endl;
+  }
+
+  batch_.clear();
+}
+
+/* send on whatever has made it through the links */
+void LinkEmulator::deliver()
+{
+  const uint64_t time = now();
+  uplink_.advance( time );
+  downlink_.advance( time );
+
+  /* uplink: to the receiver, batching runs of datagrams from the same flow
+     (the buffers go back to the pool as the batch is cleared) */
+  unsigned int batch_flow = 0;
+  while ( uplink_.has_output( time ) ) {
+    Link::Packet packet = uplink_.pop_output();
+
+    if ( not batch_.empty() and packet.flow != batch_flow ) {
+      send_batch( batch_flow );
+    }
+
+    batch_flow = packet.flow;
+    batch_.push_back( move( packet.contents ) );
+  }
+
+  if ( not batch_.empty() ) {
+    send_batch( batch_flow );
+  }
+
+  /* downlink: back to each sender */
+  while ( downlink_.has_output( time ) ) {
+    const Link::Packet packet = downlink_.pop_output();
+    listen_socket_.sendto( flows_.at( packet.flow ).sender, packet.contents );
+  }
+}
+
+/* wake up for the next thing either link has to do */
+void LinkEmulator::schedule()
+{
+  const uint64_t next = min( uplink_.next_event_time(), downlink_.next_event_time() );
+
+  if ( next == uint64_t( -1 ) ) {
+    timer_.disarm();
+  } else {
+    timer_.arm_at( next * 1000000 );
+  }
+}
+
+int LinkEmulator::loop()
+{
+  /* first rule: datagrams from senders enter the uplink */
+  poller_.add_action( Action( listen_socket_, Direction::In, [&] () {
+	const uint64_t arrival = now();
+	if ( pool_.empty() ) {
+	  /* nowhere to hold it: lost, as if the queue were full */
+	  uplink_.drop( arrival, listen_socket_.discard() + PACKET_OVERHEAD );
+	} else {
+	  for ( auto & recd : listen_socket_.recv_batch( pool_ ) ) {
+	    const size_t size = recd.length + PACKET_OVERHEAD;
+	    if ( recd.truncated() ) {
+	      /* too big to hold: lost, as if over the MTU */
+	      uplink_.drop( arrival, size );
+	      continue;
+	    }
+	    const unsigned int flow = find_flow( recd.source_address );
+	    uplink_.enqueue( arrival, Link::Packet { move( recd.payload ), size, flow } );
+	  }
+	}
+	deliver();
+	return ResultType::Continue;
+      } ) );
+
+  /* second rule: when the timer expires, run the links */
+  poller_.add_action( Action( timer_, Direction::In, [&] () {
+	timer_.acknowledge();
+	deliver();
+	return ResultType::Continue;
+      } ) );
+
+  /* (per-flow rules for the acks are added as senders appear) */
+
+  while ( true ) {
+    schedule();
+
+    const auto ret = poller_.poll( -1 );
+    if ( ret.result == PollResult::Exit ) {
+      return ret.exit_status;
+    }
+
+    /* playing the traces once: stop when the uplink trace runs out */
+    if ( uplink_.finished() ) {
+      return EXIT_SUCCESS;
+    }
+  }
+}
@@ -2,11 +2,241 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+
+#include <getopt.h>
+#include <pthread.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
+#include "poller.hh"
+#include "timerfd.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* most datagrams taken per syscall, by each socket */
+static const size_t RECEIVE_BATCH = 32;
+
+/* with aggregated acks, a sender heard nothing from for this long
+   (in microseconds), with no ack due, is forgotten */
+static const uint64_t IDLE_FLOW_TIMEOUT = 10000000;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " [--gro] [--threads N [--steer-cpu]] [--hw-timestamps INTERFACE]"
+       << " [--ack-every N [--max-ack-delay MS]] PORT" << endl;
+}
+
+/* Loop and acknowledge every incoming datagram back to its source */
+void acknowledge_forever( UDPSocket & socket, PacketPool & pool )
+{
+  /* each socket numbers its own acks */
+  uint64_t sequence_number = 0;
+
+  while ( true ) {
+    /* drain whatever has arrived with one syscall */
+    for ( auto & recd : socket.recv_batch( pool, RECEIVE_BATCH ) ) {
+      /* split coalesced buffers back into the datagrams the sender sent */
+      for ( size_t offset = 0; offset < recd.payload.size(); offset += recd.segment_size ) {
+	ContestMessageView message( recd.payload.data() + offset,
+				    min( recd.segment_size, recd.payload.size() - offset ) );
+
+	/* assemble the acknowledgment (in place, over the received header) */
+	message.transform_into_ack( sequence_number++, recd.timestamp );
+
+	/* timestamp the ack just before sending */
+	message.set_send_timestamp();
+
+	/* send the ack */
+	socket.sendto( recd.source_address, message.data(), message.length() );
+      }
+    }
+  }
+}
+
+/* The datagrams from one sender that haven't been acked yet */
+struct PendingAck
+{
+  Address source;
+  AckRanges ranges;
+  uint64_t bytes;                 /* of payload, in all of them */
+  ContestMessage::Header newest;  /* the one received last */
+  uint64_t newest_recv_timestamp;
+  uint64_t next_sequence_number;  /* the one expected next, if in order */
+  uint64_t deadline;              /* when the ack is due (in timestamp_us() terms) */
+
+  PendingAck( const Address & s_source, const uint64_t max_ack_delay )
+    : source( s_source ), ranges( max_ack_delay ), bytes( 0 ), newest( 0 ),
+      newest_recv_timestamp( 0 ), next_sequence_number( 0 ), deadline( 0 ) {}
+};
+
+/* Loop and acknowledge incoming datagrams back to their source with one
+   ack for every ack_every of them, holding none for more than
+   max_ack_delay (in microseconds), and acking right away when one
+   arrives out of order (so the sender hears of a loss promptly) or
+   fills the sender's window (so it isn't left waiting) */
+void acknowledge_aggregated( UDPSocket & socket, PacketPool & pool,
+			     const unsigned int ack_every, const uint64_t max_ack_delay )
+{
+  /* each socket numbers its own acks */
+  uint64_t sequence_number = 0;
+
+  /* one per sender (until it goes idle) */
+  unordered_map<Address, PendingAck, Address::Hash> pending;
+  uint64_t next_idle_check = 0;
+
+  /* wake up when the oldest unacked datagram can wait no longer */
+  TimerFD ack_timer;
+  uint64_t ack_timer_deadline = 0;
+
+  auto send_ack = [&] ( PendingAck & flow ) {
+    /* the header acks the newest datagram, the payload all of them */
+    ContestMessage::Header header = flow.newest;
+    header.ack_sequence_number = flow.newest.sequence_number;
+    header.sequence_number = sequence_number++;
+    header.ack_send_timestamp = flow.newest.send_timestamp;
+    header.ack_recv_timestamp = flow.newest_recv_timestamp;
+    header.ack_payload_length = flow.bytes;
+    header.ack_now = false;
+
+    /* timestamp the ack just before sending, and say how long the
+       newest datagram was held (so the sender can leave it out of its RTT) */
+    header.send_timestamp = timestamp_us();
+    flow.ranges.set_ack_delay( header.send_timestamp > flow.newest_recv_timestamp
+			       ? header.send_timestamp - flow.newest_recv_timestamp : 0 );
+
+    PacketPool::Buffer ack = pool.acquire();
+    ack.resize( ContestMessage::Header::WIRE_SIZE + flow.ranges.wire_size() );
+    header.serialize( ack.data() );
+    flow.ranges.serialize( ack.data() + ContestMessage::Header::WIRE_SIZE );
+    socket.sendto( flow.source, ack );
+
+    flow.ranges.clear();
+    flow.bytes = 0;
+    flow.deadline = 0;
+  };
+
+  Poller poller;
+
+  poller.add_action( Action( socket, Direction::In, [&] () {
+	for ( auto & recd : socket.recv_batch( pool, RECEIVE_BATCH ) ) {
+	  auto entry = pending.find( recd.source_address );
+	  if ( entry == pending.end() ) {
+	    entry = pending.emplace( recd.source_address,
+				     PendingAck( recd.source_address, max_ack_delay ) ).first;
+	  }
+	  PendingAck * const flow = &entry->second;
+
+	  /* split coalesced buffers back into the datagrams the sender sent */
+	  for ( size_t offset = 0; offset < recd.payload.size(); offset += recd.segment_size ) {
+	    const ContestMessageView message( recd.payload.data() + offset,
+					      min( recd.segment_size, recd.payload.size() - offset ) );
+	    const ContestMessage::Header header = message.header();
+
+	    /* (one ack can only say so much) */
+	    if ( not flow->ranges.add( header.sequence_number ) ) {
+	      send_ack( *flow );
+	      flow->ranges.add( header.sequence_number );
+	    }
+
+	    const bool in_order = header.sequence_number == flow->next_sequence_number;
+	    flow->next_sequence_number = max( flow->next_sequence_number, header.sequence_number + 1 );
+
+	    flow->bytes += message.payload_length();
+	    flow->newest = header;
+	    flow->newest_recv_timestamp = recd.timestamp;
+	    if ( flow->deadline == 0 ) {
+	      flow->deadline = timestamp_us() + max_ack_delay;
+	    }
+
+	    /* (ack_now: the sender can't send more until it hears back) */
+	    if ( not in_order or header.ack_now or flow->ranges.count() >= ack_every ) {
+	      send_ack( *flow );
+	    }
+	  }
+	}
+	return ResultType::Continue;
+      } ) );
+
+  poller.add_action( Action( ack_timer, Direction::In, [&] () {
+	ack_timer.acknowledge();
+
+	const uint64_t now = timestamp_us();
+	for ( auto & entry : pending ) {
+	  if ( entry.second.deadline and entry.second.deadline <= now ) {
+	    send_ack( entry.second );
+	  }
+	}
+	return ResultType::Continue;
+      } ) );
+
+  while ( true ) {
+    /* forget senders that have gone quiet (checking every so often) */
+    const uint64_t now = timestamp_us();
+    if ( now >= next_idle_check ) {
+      for ( auto entry = pending.begin(); entry != pending.end(); ) {
+	if ( entry->second.deadline == 0
+	     and elapsed( entry->second.newest_recv_timestamp, now ) > IDLE_FLOW_TIMEOUT ) {
+	  entry = pending.erase( entry );
+	} else {
+	  entry++;
+	}
+      }
+      next_idle_check = now + IDLE_FLOW_TIMEOUT / 10;
+    }
+
+    uint64_t deadline = 0;
+    for ( const auto & entry : pending ) {
+      const PendingAck & flow = entry.second;
+      if ( flow.deadline and (deadline == 0 or flow.deadline < deadline) ) {
+	deadline = flow.deadline;
+      }
+    }
+
+    if ( deadline != ack_timer_deadline ) {
+      if ( deadline ) {
+	ack_timer.arm_at( deadline * 1000 );
+      } else {
+	ack_timer.disarm();
+      }
+      ack_timer_deadline = deadline;
+    }
+
+    if ( poller.poll( -1 ).result == PollResult::Exit ) {
+      throw runtime_error( "receiver socket failed" );
+    }
+  }
+}
+
+/* Acknowledge datagrams forever, individually or (with ack_every over one) aggregated */
+void acknowledge( UDPSocket & socket, PacketPool & pool,
+		  const unsigned int ack_every, const uint64_t max_ack_delay )
+{
+  if ( ack_every > 1 ) {
+    acknowledge_aggregated( socket, pool, ack_every, max_ack_delay );
+  } else {
+    acknowledge_forever( socket, pool );
+  }
+}
+
+/* keep the calling thread on one core */
+void pin_to_core( const unsigned int core )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( core, &cpus );
+
+  const int err = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+  if ( err ) {
+    throw unix_error( "pthread_setaffinity_np", err );
+  }
+}
 
 int main( int argc, char *argv[] )
 {
@@ -15,37 +245,123 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  bool gro = false, steer_cpu = false;
+  unsigned int thread_count = 0, ack_every = 1;
+  uint64_t max_ack_delay = 5000; /* in microseconds */
+  string hardware_interface;
+
+  const option command_line_options[] = {
+    { "gro",           no_argument,       nullptr, 'g' },
+    { "threads",       required_argument, nullptr, 't' },
+    { "steer-cpu",     no_argument,       nullptr, 's' },
+    { "hw-timestamps", required_argument, nullptr, 'h' },
+    { "ack-every",     required_argument, nullptr, 'a' },
+    { "max-ack-delay", required_argument, nullptr, 'd' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "gt:sh:a:d:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'g':
+      gro = true;
+      break;
+    case 't':
+      thread_count = stoul( optarg );
+      break;
+    case 's':
+      steer_cpu = true;
+      break;
+    case 'h':
+      hardware_interface = optarg;
+      break;
+    case 'a':
+      ack_every = stoul( optarg );
+      break;
+    case 'd':
+      max_ack_delay = stoul( optarg ) * 1000;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind != 1 or (steer_cpu and thread_count == 0) or ack_every == 0 ) {
+    usage( argv[ 0 ] );
     return EXIT_FAILURE;
   }
 
-  /* create UDP socket for incoming datagrams */
-  UDPSocket socket;
+  const Address local_address( "::0", argv[ optind ] );
 
-  /* turn on timestamps on receipt */
-  socket.set_timestamps();
+  /* buffers for every socket's receive batch and the ack being sent,
+     shared by the threads (big enough for any datagram, or a coalesced
+     buffer with GRO; before the sockets, which hold on to theirs) */
+  const unsigned int socket_count = max( thread_count, 1u );
+  PacketPool pool( socket_count * (RECEIVE_BATCH + 1), UDPSocket::MAX_DATAGRAM_SIZE );
 
-  /* "bind" the socket to the user-specified local port number */
-  socket.bind( Address( "::0", argv[ 1 ] ) );
+  /* with --threads, one socket per thread shares the port (SO_REUSEPORT);
+     the kernel keeps each flow on one socket, so each flow sees the same
+     acks it would from a single-threaded receiver */
+  list<UDPSocket> sockets;
+  for ( unsigned int i = 0; i < socket_count; i++ ) {
+    /* create UDP socket for incoming datagrams */
+    sockets.emplace_back();
+    UDPSocket & socket = sockets.back();
 
-  cerr << "Listening on " << socket.local_address().to_string() << endl;
+    /* turn on timestamps on receipt (the NIC's, if asked) */
+    if ( hardware_interface.empty() ) {
+      socket.set_timestamps();
+    } else {
+      socket.enable_hardware_timestamps( hardware_interface );
+      socket.set_timestamping( false, true );
+    }
 
-  uint64_t sequence_number = 0;
+    /* let the kernel hand us runs of same-sized datagrams as one buffer */
+    if ( gro ) {
+      socket.set_gro();
+    }
 
-  /* Loop and acknowledge every incoming datagram back to its source */
-  while ( true ) {
-    const UDPSocket::received_datagram recd = socket.recv();
-    ContestMessage message = recd.payload;
+    if ( thread_count ) {
+      socket.set_reuseport();
+    }
 
-    /* assemble the acknowledgment */
-    message.transform_into_ack( sequence_number++, recd.timestamp );
+    /* "bind" the socket to the user-specified local port number */
+    socket.bind( local_address );
+  }
+
+  /* hand each datagram to the socket of the thread pinned to the receiving core */
+  if ( steer_cpu ) {
+    sockets.front().set_reuseport_cpu_steering();
+  }
+
+  cerr << "Listening on " << sockets.front().local_address().to_string();
+  if ( thread_count ) {
+    cerr << " with " << thread_count << " threads";
+  }
+  cerr << endl;
+
+  if ( thread_count == 0 ) {
+    acknowledge( sockets.front(), pool, ack_every, max_ack_delay );
+  }
 
-    /* timestamp the ack just before sending */
-    message.set_send_timestamp();
+  const unsigned int cores = max( thread::hardware_concurrency(), 1u );
+  list<thread> threads;
+  unsigned int core = 0;
+  for ( auto & socket : sockets ) {
+    threads.emplace_back( [&socket, &pool, core, ack_every, max_ack_delay] () {
+	pin_to_core( core );
+	acknowledge( socket, pool, ack_every, max_ack_delay );
+      } );
+    core = (core + 1) % cores;
+  }
 
-    /* send the ack */
-    socket.sendto( recd.source_address, message.to_string() );
+  for ( auto & thread : threads ) {
+    thread.join();
   }
 
   return EXIT_SUCCESS;
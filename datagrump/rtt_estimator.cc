@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cmath>
+
+#include "rtt_estimator.hh"
+
+using namespace std;
+
+/* gains for the smoothed RTT and its variation (RFC 6298's alpha and beta) */
+static const double ALPHA = 1.0 / 8, BETA = 1.0 / 4;
+
+/* the timeout before any RTT has been measured */
+static const uint64_t INITIAL_TIMEOUT = 1000000;
+
+/* the least the variation term adds (one clock tick, as in QUIC) */
+static const uint64_t GRANULARITY = 1000;
+
+/* the longest timeout, however many times it has backed off */
+static const uint64_t MAX_TIMEOUT = 60000000;
+
+RTTEstimator::RTTEstimator()
+  : have_sample_( false ),
+    smoothed_rtt_( 0 ),
+    rtt_variation_( 0 ),
+    backoff_( 0 ),
+    max_ack_delay_( 0 )
+{}
+
+void RTTEstimator::sample( const uint64_t rtt )
+{
+  if ( have_sample_ ) {
+    rtt_variation_ = (1 - BETA) * rtt_variation_ + BETA * fabs( smoothed_rtt_ - rtt );
+    smoothed_rtt_ = (1 - ALPHA) * smoothed_rtt_ + ALPHA * rtt;
+  } else {
+    smoothed_rtt_ = rtt;
+    rtt_variation_ = rtt / 2.0;
+    have_sample_ = true;
+  }
+
+  backoff_ = 0;
+}
+
+void RTTEstimator::back_off()
+{
+  /* (beyond this, the timeout is at its maximum anyway) */
+  backoff_ = min( backoff_ + 1, 16u );
+}
+
+uint64_t RTTEstimator::timeout() const
+{
+  const uint64_t base = have_sample_
+    ? smoothed_rtt_ + max( 4 * rtt_variation_, double( GRANULARITY ) ) + max_ack_delay_
+    : INITIAL_TIMEOUT;
+
+  return min( base << backoff_, MAX_TIMEOUT );
+}
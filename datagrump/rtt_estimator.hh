@@ -0,0 +1,41 @@
+#ifndef RTT_ESTIMATOR_HH
+#define RTT_ESTIMATOR_HH
+
+#include <cstdint>
+
+/* Smoothed RTT and RTT variation, and the timeout they give (after
+   RFC 6298, but with QUIC's floor of one clock granularity over the
+   smoothed RTT instead of a one-second minimum), all in microseconds */
+
+class RTTEstimator
+{
+private:
+  bool have_sample_;
+  double smoothed_rtt_, rtt_variation_;
+  unsigned int backoff_; /* timeouts in a row (each doubles the next) */
+  uint64_t max_ack_delay_; /* how long the receiver may hold an ack */
+
+public:
+  RTTEstimator();
+
+  /* an RTT measurement (also ends any backoff: the path is alive) */
+  void sample( const uint64_t rtt );
+
+  /* the timeout expired without an ack */
+  void back_off();
+
+  /* the receiver may hold acks this long (added to the timeout, as in QUIC) */
+  void set_max_ack_delay( const uint64_t max_ack_delay ) { max_ack_delay_ = max_ack_delay; }
+
+  /* how long to wait for an ack before probing */
+  uint64_t timeout() const;
+
+  /* timeouts in a row so far */
+  unsigned int backoff() const { return backoff_; }
+
+  bool have_sample() const { return have_sample_; }
+  double smoothed_rtt() const { return smoothed_rtt_; }
+  double rtt_variation() const { return rtt_variation_; }
+};
+
+#endif /* RTT_ESTIMATOR_HH */
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "scoreboard.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* datagrams acked after one before it was sent that mean it was lost */
+static const uint64_t PACKET_THRESHOLD = 3;
+
+/* how much longer than an RTT a datagram may be out once a later one was acked */
+static const double TIME_THRESHOLD = 9.0 / 8;
+
+/* (but never less than this, in microseconds) */
+static const uint64_t TIME_GRANULARITY = 1000;
+
+/* the first RTT estimate, in microseconds (until an ack gives a real one) */
+static const uint64_t INITIAL_RTT = 100000;
+
+Scoreboard::Scoreboard()
+  : ring_( 1024 ),
+    oldest_( 0 ),
+    next_( 0 ),
+    in_flight_( 0 ),
+    bytes_in_flight_( 0 ),
+    any_acked_( false ),
+    largest_acked_( 0 ),
+    latest_rtt_( INITIAL_RTT ),
+    smoothed_rtt_( INITIAL_RTT ),
+    lost_()
+{}
+
+/* double the ring, keeping each unsettled datagram at its new index */
+void Scoreboard::grow()
+{
+  vector<Entry> old_ring( ring_.size() * 2 );
+  swap( ring_, old_ring );
+
+  for ( uint64_t i = oldest_; i < next_; i++ ) {
+    entry( i ) = old_ring[ i & (old_ring.size() - 1) ];
+  }
+}
+
+void Scoreboard::sent( const uint64_t sequence_number, const uint64_t send_time, const uint32_t bytes )
+{
+  if ( sequence_number != next_ ) {
+    throw runtime_error( "Scoreboard: datagrams must be sent in order" );
+  }
+
+  if ( next_ - oldest_ == ring_.size() ) {
+    grow();
+  }
+
+  entry( next_++ ) = { send_time, bytes, State::InFlight };
+  in_flight_++;
+  bytes_in_flight_ += bytes;
+}
+
+/* mark a datagram acked or lost, and forget everything settled at the front */
+void Scoreboard::settle( const uint64_t sequence_number, const State state )
+{
+  Entry & settled = entry( sequence_number );
+  settled.state = state;
+  in_flight_--;
+  bytes_in_flight_ -= settled.bytes;
+
+  while ( oldest_ < next_ and entry( oldest_ ).state != State::InFlight ) {
+    oldest_++;
+  }
+}
+
+bool Scoreboard::acked( const uint64_t sequence_number, const uint64_t now )
+{
+  if ( sequence_number < oldest_ or sequence_number >= next_
+       or entry( sequence_number ).state != State::InFlight ) {
+    return false;
+  }
+
+  /* (only the newest datagram's RTT tells us about the path now) */
+  if ( not any_acked_ or sequence_number > largest_acked_ ) {
+    const uint64_t send_time = entry( sequence_number ).send_time;
+    latest_rtt_ = elapsed( send_time, now );
+    smoothed_rtt_ = any_acked_ ? 0.875 * smoothed_rtt_ + 0.125 * latest_rtt_ : latest_rtt_;
+
+    any_acked_ = true;
+    largest_acked_ = sequence_number;
+  }
+
+  settle( sequence_number, State::Acked );
+  return true;
+}
+
+uint64_t Scoreboard::loss_delay() const
+{
+  return max( uint64_t( TIME_THRESHOLD * max( smoothed_rtt_, double( latest_rtt_ ) ) ),
+	      TIME_GRANULARITY );
+}
+
+const vector<uint64_t> & Scoreboard::detect_losses( const uint64_t now )
+{
+  lost_.clear();
+
+  if ( not any_acked_ ) {
+    return lost_;
+  }
+
+  /* only datagrams sent before the largest acked can be lost */
+  const uint64_t delay = loss_delay();
+  for ( uint64_t i = oldest_; i < largest_acked_; i++ ) {
+    const Entry & candidate = entry( i );
+    if ( candidate.state != State::InFlight ) {
+      continue;
+    }
+
+    if ( largest_acked_ - i >= PACKET_THRESHOLD or now >= candidate.send_time + delay ) {
+      lost_.push_back( i );
+    }
+  }
+
+  for ( const auto sequence_number : lost_ ) {
+    settle( sequence_number, State::Lost );
+  }
+
+  return lost_;
+}
+
+uint64_t Scoreboard::loss_time() const
+{
+  /* (everything in flight before the largest acked is within the packet
+     threshold, so the oldest of it is the first to reach the time threshold) */
+  if ( not any_acked_ or oldest_ >= largest_acked_ ) {
+    return 0;
+  }
+
+  return entry( oldest_ ).send_time + loss_delay();
+}
@@ -0,0 +1,75 @@
+#ifndef SCOREBOARD_HH
+#define SCOREBOARD_HH
+
+#include <cstdint>
+#include <vector>
+
+/* The sender's record of each datagram it has sent until the datagram
+   is settled (acked, or declared lost), in a ring indexed by sequence
+   number. Each datagram is acked by sequence number (one per ack, or
+   several to an aggregated ack), so the acks say exactly which
+   datagrams arrived. Loss detection follows QUIC (RFC 9002): a
+   datagram is lost once one sent PACKET_THRESHOLD later has been
+   acked, or once any later one has been acked and it has been out for
+   9/8 of an RTT. */
+
+class Scoreboard
+{
+private:
+  enum class State : uint8_t { InFlight, Acked, Lost };
+
+  struct Entry
+  {
+    uint64_t send_time; /* in microseconds */
+    uint32_t bytes;
+    State state;
+  };
+
+  std::vector<Entry> ring_; /* size is a power of two */
+  uint64_t oldest_;         /* every datagram before this one is settled */
+  uint64_t next_;           /* the next sequence number to be sent */
+
+  uint64_t in_flight_, bytes_in_flight_;
+
+  bool any_acked_;
+  uint64_t largest_acked_;
+
+  /* for the time threshold, in microseconds */
+  uint64_t latest_rtt_;
+  double smoothed_rtt_;
+
+  std::vector<uint64_t> lost_; /* storage reused by detect_losses() */
+
+  Entry & entry( const uint64_t sequence_number )
+  { return ring_[ sequence_number & (ring_.size() - 1) ]; }
+  const Entry & entry( const uint64_t sequence_number ) const
+  { return ring_[ sequence_number & (ring_.size() - 1) ]; }
+
+  void grow();
+  void settle( const uint64_t sequence_number, const State state );
+  uint64_t loss_delay() const;
+
+public:
+  Scoreboard();
+
+  /* a datagram was sent (in sequence-number order), at a time in microseconds */
+  void sent( const uint64_t sequence_number, const uint64_t send_time, const uint32_t bytes );
+
+  /* an ack arrived; false if its datagram was already settled
+     (e.g. it was declared lost, but was only reordered) */
+  bool acked( const uint64_t sequence_number, const uint64_t now );
+
+  /* declare lost whatever the acks so far show to be lost
+     (the sequence numbers returned are valid until the next call) */
+  const std::vector<uint64_t> & detect_losses( const uint64_t now );
+
+  /* when the oldest datagram in flight will be lost by the time threshold
+     if no ack comes first (zero if no ack has come after it yet) */
+  uint64_t loss_time() const;
+
+  /* datagrams (and bytes) sent and not yet settled */
+  uint64_t in_flight() const { return in_flight_; }
+  uint64_t bytes_in_flight() const { return bytes_in_flight_; }
+};
+
+#endif /* SCOREBOARD_HH */
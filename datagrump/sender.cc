@@ -2,39 +2,351 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cerrno>
+
+#include <getopt.h>
+#include <sys/prctl.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
-#include "controller.hh"
+#include "controller_registry.hh"
 #include "poller.hh"
+#include "timestamp.hh"
+#include "timerfd.hh"
+#include "scoreboard.hh"
+#include "event_trace.hh"
+#include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-/* simple sender class to handle the accounting */
+/* simple sender class to handle the accounting for one flow
+   (a connected socket, its sequence numbers, and its controller) */
 class DatagrumpSender
 {
 private:
+  /* buffers the acks arrive in (before the socket, which holds on to them) */
+  PacketPool ack_pool_;
   UDPSocket socket_;
-  Controller controller_; /* your class */
+  std::unique_ptr<Controller> controller_; /* your class */
 
   uint64_t sequence_number_; /* next outgoing sequence number */
 
-  /* if network does not reorder or lose datagrams,
-     this is the sequence number that the sender
-     next expects will be acknowledged by the receiver */
-  uint64_t next_ack_expected_;
+  /* every datagram in flight, and which have been acked or lost */
+  Scoreboard scoreboard_;
+
+  /* the datagrams an aggregated ack covers (reused by each one) */
+  AckRanges ack_ranges_;
+
+  /* wake up when a datagram in flight will be declared lost
+     (if no ack comes first) */
+  TimerFD loss_timer_;
+  uint64_t loss_timer_deadline_; /* in timestamp_us() terms (zero: disarmed) */
+
+  /* send each window-opening burst with one syscall */
+  bool batch_;
+
+  /* datagrams per buffer handed to the kernel (more than one with GSO) */
+  size_t segments_per_buffer_;
+
+  /* wire representation of the last single datagram sent */
+  std::string datagram_;
+
+  /* wire representations of the datagrams in the current burst */
+  std::vector<std::string> burst_;
+
+  /* pace datagrams at the controller's rate: a token bucket refilled
+     from the monotonic clock, and a timer to wake up for the next token */
+  bool pacing_;
+  TimerFD pacing_timer_;
+  double pacing_tokens_;
+  uint64_t last_refill_; /* in timestamp_ns() terms */
+
+  /* with transmit timestamps, the kernel numbers each send (a datagram,
+     or a GSO buffer of them), and reports when it left by that number */
+  bool transmit_timestamps_;
+  uint32_t next_send_id_;
+
+  struct Send
+  {
+    uint32_t id;
+    uint64_t first_sequence_number;
+    uint64_t count;
+  };
+  std::vector<Send> sends_; /* ring, indexed by send id */
+
+  struct Transmission
+  {
+    uint64_t sequence_number;
+    uint64_t timestamp;
+  };
+  std::vector<Transmission> transmissions_; /* ring, indexed by sequence number */
+
+  /* send a probe if nothing has happened for the controller's timeout */
+  TimerFD probe_timer_;
+  uint64_t last_activity_;  /* in timestamp_ns() terms */
+  uint64_t probe_deadline_; /* as armed (zero: disarmed) */
+
+  /* when this flow sends, in timestamp_ns() terms (a stop time of zero: never stops) */
+  uint64_t start_time_, stop_time_;
+  bool sending_, stopped_;
+
+public:
+  /* what the flow has seen (since it started, or since the last report) */
+  struct Statistics
+  {
+    uint64_t datagrams_sent, datagrams_acked, datagrams_lost;
+    uint64_t rtt_sum, rtt_samples; /* in microseconds */
+    uint64_t start;                /* in timestamp_ns() terms */
+
+    Statistics( const uint64_t s_start )
+      : datagrams_sent( 0 ), datagrams_acked( 0 ), datagrams_lost( 0 ),
+	rtt_sum( 0 ), rtt_samples( 0 ), start( s_start ) {}
+
+    /* in Mbit/s of datagrams acked, up to a given time */
+    double throughput( const uint64_t now ) const;
+  };
+
+private:
+  Statistics total_, interval_;
+
+  /* where to record events (if anywhere), as which flow */
+  EventTrace * trace_;
+  uint16_t flow_;
+  unsigned int last_window_; /* as last traced */
+
+  /* (timestamped when the event loop woke up for the flow) */
+  void trace( const TraceEvent::Type type, const uint64_t sequence_number,
+	      const uint32_t count = 0, const uint64_t value = 0 )
+  {
+    if ( trace_ ) {
+      trace_->record( last_activity_, type, flow_, count, sequence_number, value );
+    }
+  }
 
   void send_datagram( const bool after_timeout );
-  void got_ack( const uint64_t timestamp, const ContestMessage & msg );
+  void send_burst();
+  void got_ack( const uint64_t timestamp, const ContestMessageView & ack );
+  void detect_losses( const uint64_t timestamp );
+  void schedule_loss_detection();
+  void record_send( const uint64_t first_sequence_number, const uint64_t count );
+  void got_transmit_timestamps();
   bool window_is_open();
+  bool window_fills();
+  bool can_send();
+  void schedule_pacing();
+  void schedule_probe();
+  void print_statistics( const unsigned int flow, const Statistics & statistics,
+			 const uint64_t now, const std::string & label ) const;
 
 public:
   DatagrumpSender( const char * const host, const char * const port,
-		   const bool debug );
-  int loop();
+		   std::unique_ptr<Controller> && controller,
+		   const bool batch, const bool gso, const bool pacing,
+		   const bool transmit_timestamps, const std::string & hardware_interface );
+
+  /* record events to a trace, shared with other flows (in this thread) */
+  void set_trace( EventTrace * const trace, const uint16_t flow );
+
+  /* send from start to stop (in timestamp_ns() terms; stop zero: forever) */
+  void set_schedule( const uint64_t start, const uint64_t stop );
+  uint64_t start_time() const { return start_time_; }
+  uint64_t stop_time() const { return stop_time_; }
+  bool started() const { return sending_ or stopped_; }
+  bool stopped() const { return stopped_; }
+  void start( const uint64_t now );
+  void stop( const uint64_t now, const unsigned int flow );
+
+  /* add this flow's rules to an event loop shared with other flows */
+  void add_actions( Poller & poller );
+
+  /* arm the flow's timers (call before each poll) */
+  void schedule();
+
+  /* report on the last interval (and start the next); returns its throughput */
+  double report_interval( const uint64_t now, const unsigned int flow );
+
+  /* forbid copying or assigning */
+  DatagrumpSender( const DatagrumpSender & other ) = delete;
+  const DatagrumpSender & operator=( const DatagrumpSender & other ) = delete;
 };
 
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [--controller NAME[:KEY=VALUE,...]] [--batch] [--gso] [--pacing]"
+       << " [--tx-timestamps] [--hw-timestamps INTERFACE]"
+       << " [--flows N [--stagger MS] [--flow-duration MS]] [--stats-interval MS] [--trace FILE]"
+       << " HOST PORT [debug]" << endl
+       << "Controllers (default delay), with their settings' defaults:" << endl;
+
+  for ( const auto & type : controller_types() ) {
+    cerr << "  " << type.name << string( max( 8 - int( type.name.size() ), 1 ), ' ' )
+	 << type.parameters << (type.paced ? " (always paced)" : "") << endl;
+  }
+}
+
+/* All messages use the same dummy payload */
+static const string & dummy_payload()
+{
+  static const string payload( 1424, 'x' );
+  return payload;
+}
+
+/* Most acks taken per syscall */
+static const size_t ACK_BATCH = 32;
+
+/* Datagrams a paced sender may send back-to-back (to absorb timer latency) */
+static const double PACING_BURST = 2;
+
+/* Sends and datagrams whose transmit timestamps can still be matched up */
+static const size_t TRANSMIT_HISTORY = 16384;
+
+/* Size of each datagram on the wire */
+static size_t datagram_size()
+{
+  return ContestMessage::Header::WIRE_SIZE + dummy_payload().size();
+}
+
+/* Write a datagram into the nth slot of a buffer of back-to-back datagrams.
+   The payload is copied in only when the buffer first grows to hold the slot;
+   after that, each datagram costs just a rewrite of its header. */
+static void write_datagram( string & buffer, const size_t slot,
+			    const ContestMessage::Header & header )
+{
+  const size_t offset = slot * datagram_size();
+
+  if ( buffer.size() < offset + datagram_size() ) {
+    buffer.resize( offset + ContestMessage::Header::WIRE_SIZE );
+    buffer.append( dummy_payload() );
+  }
+
+  header.serialize( &buffer[ offset ] );
+}
+
+/* Jain's fairness index: 1 when every flow gets the same, 1/n when one gets it all */
+static double fairness( const vector<double> & throughputs )
+{
+  double sum = 0, sum_of_squares = 0;
+  for ( const auto throughput : throughputs ) {
+    sum += throughput;
+    sum_of_squares += throughput * throughput;
+  }
+
+  return sum_of_squares > 0 ? sum * sum / (throughputs.size() * sum_of_squares) : 1;
+}
+
+/* Run the flows in one event loop, starting and stopping each on its
+   schedule, until they have all stopped (reporting every stats_interval
+   nanoseconds, if that isn't zero) or the receiver goes away */
+static int run_flows( vector<unique_ptr<DatagrumpSender>> & flows, const uint64_t stats_interval )
+{
+  /* read and write from the receiver using an event-driven "poller" */
+  Poller poller;
+
+  for ( auto & flow : flows ) {
+    flow->add_actions( poller );
+  }
+
+  /* wake up when a flow is due to start or stop, or a report is due */
+  TimerFD schedule_timer;
+  uint64_t next_report = stats_interval ? timestamp_ns() + stats_interval : 0;
+
+  poller.add_action( Action( schedule_timer, Direction::In, [&] () {
+	schedule_timer.acknowledge();
+	const uint64_t now = timestamp_ns();
+
+	if ( next_report and now >= next_report ) {
+	  vector<double> throughputs;
+	  for ( unsigned int i = 0; i < flows.size(); i++ ) {
+	    if ( flows[ i ]->started() and not flows[ i ]->stopped() ) {
+	      throughputs.push_back( flows[ i ]->report_interval( now, i ) );
+	    }
+	  }
+
+	  if ( flows.size() > 1 and not throughputs.empty() ) {
+	    cout << "At time " << now / 1000000 << " ms fairness "
+		 << fairness( throughputs ) << " over " << throughputs.size() << " flows" << endl;
+	  }
+
+	  next_report += stats_interval;
+	}
+
+	for ( unsigned int i = 0; i < flows.size(); i++ ) {
+	  if ( not flows[ i ]->started() and now >= flows[ i ]->start_time() ) {
+	    flows[ i ]->start( now );
+	  } else if ( not flows[ i ]->stopped() and flows[ i ]->stop_time()
+		      and now >= flows[ i ]->stop_time() ) {
+	    flows[ i ]->stop( now, i );
+	  }
+	}
+
+	if ( all_of( flows.begin(), flows.end(),
+		     [] ( const unique_ptr<DatagrumpSender> & flow ) { return flow->stopped(); } ) ) {
+	  return ResultType::Exit;
+	}
+
+	return ResultType::Continue;
+      } ) );
+
+  uint64_t schedule_deadline = 0;
+
+  /* Run these rules until every flow has stopped */
+  while ( true ) {
+    uint64_t deadline = next_report;
+    for ( const auto & flow : flows ) {
+      uint64_t event = 0;
+      if ( not flow->started() ) {
+	event = flow->start_time();
+      } else if ( not flow->stopped() ) {
+	event = flow->stop_time();
+      }
+
+      if ( event and (deadline == 0 or event < deadline) ) {
+	deadline = event;
+      }
+    }
+
+    if ( deadline != schedule_deadline ) {
+      if ( deadline ) {
+	schedule_timer.arm_at( deadline );
+      } else {
+	schedule_timer.disarm();
+      }
+      schedule_deadline = deadline;
+    }
+
+    for ( auto & flow : flows ) {
+      flow->schedule();
+    }
+
+    try {
+      const auto ret = poller.poll( -1 );
+      if ( ret.result == PollResult::Exit ) {
+	return ret.exit_status;
+      }
+    } catch ( const unix_error & e ) {
+      if ( e.code().value() != ECONNREFUSED ) {
+	throw;
+      }
+
+      /* nothing is listening at the receiver's address (any more), and
+	 every flow goes there: stop them all where they are */
+      cerr << "Receiver went away: " << e.what() << endl;
+      const uint64_t now = timestamp_ns();
+      for ( unsigned int i = 0; i < flows.size(); i++ ) {
+	if ( flows[ i ]->started() and not flows[ i ]->stopped() ) {
+	  flows[ i ]->stop( now, i );
+	}
+      }
+      return EXIT_FAILURE;
+    }
+  }
+}
+
 int main( int argc, char *argv[] )
 {
    /* check the command-line arguments */
@@ -42,32 +354,196 @@ int main( int argc, char *argv[] )
     abort();
   }
 
+  bool batch = false, gso = false, pacing = false, transmit_timestamps = false;
+  string controller_spec = "delay", hardware_interface;
+  unsigned int flow_count = 1;
+  uint64_t stagger = 0, flow_duration = 0, stats_interval = 0; /* in milliseconds */
+  string trace_filename;
+
+  const option command_line_options[] = {
+    { "controller",    required_argument, nullptr, 'c' },
+    { "batch",         no_argument,       nullptr, 'b' },
+    { "gso",           no_argument,       nullptr, 'g' },
+    { "pacing",        no_argument,       nullptr, 'p' },
+    { "tx-timestamps", no_argument,       nullptr, 't' },
+    { "hw-timestamps", required_argument, nullptr, 'h' },
+    { "flows",         required_argument, nullptr, 'n' },
+    { "stagger",       required_argument, nullptr, 's' },
+    { "flow-duration", required_argument, nullptr, 'd' },
+    { "stats-interval", required_argument, nullptr, 'i' },
+    { "trace",         required_argument, nullptr, 'r' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "c:bgpth:n:s:d:i:r:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'c':
+      controller_spec = optarg;
+      break;
+    case 'b':
+      batch = true;
+      break;
+    case 'g':
+      /* segmentation offload works on whole bursts */
+      batch = gso = true;
+      break;
+    case 'p':
+      pacing = true;
+      break;
+    case 't':
+      transmit_timestamps = true;
+      break;
+    case 'h':
+      /* the NIC's timestamps, in both directions */
+      transmit_timestamps = true;
+      hardware_interface = optarg;
+      break;
+    case 'n':
+      flow_count = stoul( optarg );
+      break;
+    case 's':
+      stagger = stoul( optarg );
+      break;
+    case 'd':
+      flow_duration = stoul( optarg );
+      break;
+    case 'i':
+      stats_interval = stoul( optarg );
+      break;
+    case 'r':
+      trace_filename = optarg;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  const int positional = argc - optind;
+
   bool debug = false;
-  if ( argc == 4 and string( argv[ 3 ] ) == "debug" ) {
+  if ( positional == 3 and string( argv[ optind + 2 ] ) == "debug" ) {
     debug = true;
-  } else if ( argc == 3 ) {
+  } else if ( positional == 2 ) {
     /* do nothing */
   } else {
-    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug]" << endl;
+    usage( argv[ 0 ] );
     return EXIT_FAILURE;
   }
 
-  /* create sender object to handle the accounting */
-  /* all the interesting work is done by the Controller */
-  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], debug );
-  return sender.loop();
+  if ( flow_count == 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* pick the congestion controller: NAME, then any settings after a colon */
+  const size_t colon = controller_spec.find( ':' );
+  const string controller_name = controller_spec.substr( 0, colon );
+  const string controller_settings = colon == string::npos ? "" : controller_spec.substr( colon + 1 );
+
+  /* each flow gets a controller of its own */
+  vector<unique_ptr<Controller>> controllers;
+  try {
+    const ControllerType & type = find_controller_type( controller_name );
+    for ( unsigned int i = 0; i < flow_count; i++ ) {
+      controllers.push_back( type.make( controller_settings, debug ) );
+    }
+    pacing |= type.paced;
+  } catch ( const runtime_error & e ) {
+    cerr << argv[ 0 ] << ": " << e.what() << endl;
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* create sender objects to handle the accounting, one per flow
+     (each with its own socket and sequence numbers), starting
+     a stagger apart; all the interesting work is done by the Controllers */
+  /* record every flow's events to one trace (decode it with tracedump) */
+  unique_ptr<EventTrace> trace;
+  if ( not trace_filename.empty() ) {
+    trace.reset( new EventTrace( trace_filename ) );
+  }
+
+  const uint64_t now = timestamp_ns();
+  vector<unique_ptr<DatagrumpSender>> flows;
+  for ( unsigned int i = 0; i < flow_count; i++ ) {
+    flows.emplace_back( new DatagrumpSender( argv[ optind ], argv[ optind + 1 ], move( controllers.at( i ) ),
+					     batch, gso, pacing, transmit_timestamps, hardware_interface ) );
+
+    const uint64_t start = now + i * stagger * 1000000;
+    flows.back()->set_schedule( start, flow_duration ? start + flow_duration * 1000000 : 0 );
+    flows.back()->set_trace( trace.get(), i );
+  }
+
+  return run_flows( flows, stats_interval * 1000000 );
 }
 
 DatagrumpSender::DatagrumpSender( const char * const host,
 				  const char * const port,
-				  const bool debug )
-  : socket_(),
-    controller_( debug ),
+				  unique_ptr<Controller> && controller,
+				  const bool batch,
+				  const bool gso,
+				  const bool pacing,
+				  const bool transmit_timestamps,
+				  const string & hardware_interface )
+  : ack_pool_( ACK_BATCH ),
+    socket_(),
+    controller_( move( controller ) ),
     sequence_number_( 0 ),
-    next_ack_expected_( 0 )
+    scoreboard_(),
+    ack_ranges_( 0 ),
+    loss_timer_(),
+    loss_timer_deadline_( 0 ),
+    batch_( batch ),
+    segments_per_buffer_( 1 ),
+    datagram_(),
+    burst_(),
+    pacing_( pacing ),
+    pacing_timer_(),
+    pacing_tokens_( PACING_BURST ),
+    last_refill_( timestamp_ns() ),
+    transmit_timestamps_( transmit_timestamps ),
+    next_send_id_( 0 ),
+    sends_( transmit_timestamps ? TRANSMIT_HISTORY : 0, Send { uint32_t( -1 ), 0, 0 } ),
+    transmissions_( transmit_timestamps ? TRANSMIT_HISTORY : 0, Transmission { uint64_t( -1 ), 0 } ),
+    probe_timer_(),
+    last_activity_( 0 ),
+    probe_deadline_( 0 ),
+    start_time_( 0 ),
+    stop_time_( 0 ),
+    sending_( false ),
+    stopped_( false ),
+    total_( 0 ),
+    interval_( 0 ),
+    trace_( nullptr ),
+    flow_( 0 ),
+    last_window_( 0 )
 {
-  /* turn on timestamps when socket receives a datagram */
-  socket_.set_timestamps();
+  if ( transmit_timestamps_ ) {
+    /* timestamps when datagrams leave and when acks arrive (this
+       must come before the first send, which the kernel numbers 0) */
+    if ( not hardware_interface.empty() ) {
+      socket_.enable_hardware_timestamps( hardware_interface );
+    }
+    socket_.set_timestamping( true, not hardware_interface.empty() );
+  } else {
+    /* turn on timestamps when socket receives a datagram */
+    socket_.set_timestamps();
+  }
+
+  if ( gso ) {
+    /* every datagram has the same size, so the kernel can split
+       a buffer of back-to-back datagrams into separate ones */
+    static const size_t MAX_GSO_SEGMENTS = 64, MAX_GSO_BYTES = 65507;
+
+    socket_.set_gso_segment_size( datagram_size() );
+    segments_per_buffer_ = min( MAX_GSO_SEGMENTS, MAX_GSO_BYTES / datagram_size() );
+  }
 
   /* connect socket to the remote host */
   /* (note: this doesn't send anything; it just tags the socket
@@ -75,81 +551,418 @@ DatagrumpSender::DatagrumpSender( const char * const host,
   socket_.connect( Address( host, port ) );  
 
   cerr << "Sending to " << socket_.peer_address().to_string() << endl;
+
+  if ( pacing_ ) {
+    /* wake up as close to each datagram's time as the kernel allows */
+    prctl( PR_SET_TIMERSLACK, 1UL );
+  }
 }
 
 void DatagrumpSender::got_ack( const uint64_t timestamp,
-			       const ContestMessage & ack )
+			       const ContestMessageView & ack )
 {
   if ( not ack.is_ack() ) {
     throw runtime_error( "sender got something other than an ack from the receiver" );
   }
 
-  /* Update sender's counter */
-  next_ack_expected_ = max( next_ack_expected_,
-			    ack.header.ack_sequence_number + 1 );
+  const ContestMessage::Header header = ack.header();
+
+  /* the RTT runs from when the datagram left the host, if we know */
+  uint64_t send_timestamp = header.ack_send_timestamp;
+  if ( transmit_timestamps_ ) {
+    const Transmission & transmission = transmissions_[ header.ack_sequence_number % transmissions_.size() ];
+    if ( transmission.sequence_number == header.ack_sequence_number ) {
+      send_timestamp = transmission.timestamp;
+    }
+  }
+
+  /* Update the scoreboard with every datagram the ack covers */
+  ack_ranges_.parse( ack.payload(), ack.payload_length() );
+  const AckRanges & ranges = ack_ranges_;
+
+  /* (the RTT leaves out how long the receiver held the ack) */
+  send_timestamp += min( ranges.ack_delay(), elapsed( send_timestamp, timestamp ) );
+  if ( ranges.empty() ) {
+    scoreboard_.acked( header.ack_sequence_number, timestamp );
+  } else {
+    controller_->set_max_ack_delay( ranges.max_ack_delay() );
+
+    /* (newest first: the scoreboard takes its RTT sample from the largest acked) */
+    for ( auto range = ranges.ranges().rbegin(); range != ranges.ranges().rend(); range++ ) {
+      for ( uint64_t sequence_number = range->last + 1; sequence_number-- > range->first; ) {
+	scoreboard_.acked( sequence_number, timestamp );
+      }
+    }
+  }
+
+  const unsigned int datagrams_acked = ranges.empty() ? 1 : ranges.count();
+  trace( TraceEvent::Type::Acked, header.ack_sequence_number, datagrams_acked, header.ack_recv_timestamp );
+  /* (a zero RTT is clock jitter, not a sample, as for the controllers) */
+  const uint64_t rtt = elapsed( send_timestamp, timestamp );
+  trace( TraceEvent::Type::RTTSample, header.ack_sequence_number, 0, rtt );
+  for ( Statistics * statistics : { &total_, &interval_ } ) {
+    statistics->datagrams_acked += datagrams_acked;
+    if ( rtt ) {
+      statistics->rtt_sum += rtt;
+      statistics->rtt_samples++;
+    }
+  }
 
   /* Inform congestion controller */
-  controller_.ack_received( ack.header.ack_sequence_number,
-			    ack.header.ack_send_timestamp,
-			    ack.header.ack_recv_timestamp,
-			    timestamp );
+  controller_->ack_received( header.ack_sequence_number,
+			    send_timestamp,
+			    header.ack_recv_timestamp,
+			    timestamp,
+			    datagrams_acked );
+
+  /* the ack may show that datagrams sent before it were lost */
+  detect_losses( timestamp );
+}
+
+/* Declare lost whatever the scoreboard says is, and inform the controller */
+void DatagrumpSender::detect_losses( const uint64_t timestamp )
+{
+  for ( const auto sequence_number : scoreboard_.detect_losses( timestamp ) ) {
+    total_.datagrams_lost++;
+    interval_.datagrams_lost++;
+    trace( TraceEvent::Type::Lost, sequence_number );
+    controller_->datagram_was_lost( sequence_number, timestamp );
+  }
+}
+
+/* Wake up when the oldest datagram in flight would be declared lost */
+void DatagrumpSender::schedule_loss_detection()
+{
+  const uint64_t deadline = scoreboard_.loss_time();
+  if ( deadline == loss_timer_deadline_ ) {
+    return;
+  }
+
+  if ( deadline ) {
+    loss_timer_.arm_at( deadline * 1000 );
+  } else {
+    loss_timer_.disarm();
+  }
+
+  loss_timer_deadline_ = deadline;
 }
 
 void DatagrumpSender::send_datagram( const bool after_timeout )
 {
-  /* All messages use the same dummy payload */
-  static const string dummy_payload( 1424, 'x' );
+  ContestMessage::Header header( sequence_number_++ );
+  header.send_timestamp = timestamp_us();
+  header.ack_now = window_fills();
+  write_datagram( datagram_, 0, header );
+  socket_.send( datagram_ );
+  record_send( header.sequence_number, 1 );
+  scoreboard_.sent( header.sequence_number, header.send_timestamp, datagram_.size() );
+  total_.datagrams_sent++;
+  interval_.datagrams_sent++;
+  trace( TraceEvent::Type::Sent, header.sequence_number, after_timeout );
 
-  ContestMessage cm( sequence_number_++, dummy_payload );
-  cm.set_send_timestamp();
-  socket_.send( cm.to_string() );
+  if ( pacing_ ) {
+    pacing_tokens_--;
+  }
 
   /* Inform congestion controller */
-  controller_.datagram_was_sent( cm.header.sequence_number,
-				 cm.header.send_timestamp,
+  controller_->datagram_was_sent( header.sequence_number,
+				 header.send_timestamp,
 				 after_timeout );
 }
 
+/* Stamp every datagram that fits in the window and send them with one syscall */
+void DatagrumpSender::send_burst()
+{
+  /* the whole burst leaves with one syscall, so it shares one timestamp */
+  const uint64_t send_timestamp = timestamp_us();
+  const uint64_t first_sequence_number = sequence_number_;
+  size_t count = 0, segments_in_buffer = 0;
+
+  while ( can_send() ) {
+    ContestMessage::Header header( sequence_number_++ );
+    header.send_timestamp = send_timestamp;
+    header.ack_now = window_fills();
+
+    if ( pacing_ ) {
+      pacing_tokens_--;
+    }
+
+    /* start a new buffer when the current one is full */
+    if ( count == 0 or segments_in_buffer == segments_per_buffer_ ) {
+      if ( count == burst_.size() ) {
+	burst_.emplace_back();
+      }
+      count++;
+      segments_in_buffer = 0;
+    }
+
+    write_datagram( burst_[ count - 1 ], segments_in_buffer++, header );
+
+    /* trim a buffer that held more datagrams in an earlier burst */
+    burst_[ count - 1 ].resize( segments_in_buffer * datagram_size() );
+
+    /* (now, so that it counts against the window for the rest of the burst) */
+    scoreboard_.sent( header.sequence_number, send_timestamp, datagram_size() );
+  }
+
+  socket_.send_batch( burst_.begin(), burst_.begin() + count );
+
+  const uint64_t total = sequence_number_ - first_sequence_number;
+  total_.datagrams_sent += total;
+  interval_.datagrams_sent += total;
+  for ( size_t i = 0; i < count; i++ ) {
+    const uint64_t first_in_buffer = i * segments_per_buffer_;
+    record_send( first_sequence_number + first_in_buffer,
+		 min( uint64_t( segments_per_buffer_ ), total - first_in_buffer ) );
+  }
+
+  /* Trace each datagram, and inform congestion controller */
+  for ( uint64_t i = 0; i < total; i++ ) {
+    trace( TraceEvent::Type::Sent, first_sequence_number + i );
+    controller_->datagram_was_sent( first_sequence_number + i,
+				   send_timestamp,
+				   false );
+  }
+}
+
+/* Remember which datagrams a send carried, to match up its transmit timestamp */
+void DatagrumpSender::record_send( const uint64_t first_sequence_number, const uint64_t count )
+{
+  if ( not transmit_timestamps_ ) {
+    return;
+  }
+
+  const uint32_t id = next_send_id_++;
+  sends_[ id % sends_.size() ] = { id, first_sequence_number, count };
+}
+
+/* Read transmit timestamps from the socket and inform the controller */
+void DatagrumpSender::got_transmit_timestamps()
+{
+  for ( const auto & transmitted : socket_.recv_transmit_timestamps() ) {
+    const Send & send = sends_[ transmitted.id % sends_.size() ];
+    if ( send.id != transmitted.id ) {
+      continue; /* too old */
+    }
+
+    for ( uint64_t i = 0; i < send.count; i++ ) {
+      const uint64_t sequence_number = send.first_sequence_number + i;
+      transmissions_[ sequence_number % transmissions_.size() ] = { sequence_number, transmitted.timestamp };
+      trace( TraceEvent::Type::Transmitted, sequence_number, 0, transmitted.timestamp );
+
+      /* Inform congestion controller */
+      controller_->datagram_was_transmitted( sequence_number, transmitted.timestamp );
+    }
+  }
+}
+
+/* Will the next datagram sent fill the window? */
+bool DatagrumpSender::window_fills()
+{
+  return scoreboard_.in_flight() + 1 >= controller_->window_size();
+}
+
 bool DatagrumpSender::window_is_open()
 {
-  return sequence_number_ - next_ack_expected_ < controller_.window_size();
+  const unsigned int window = controller_->window_size();
+  if ( window != last_window_ ) {
+    trace( TraceEvent::Type::Window, 0, window, scoreboard_.in_flight() );
+    last_window_ = window;
+  }
+
+  return scoreboard_.in_flight() < window;
 }
 
-int DatagrumpSender::loop()
+/* Is the flow sending, is the window open, and (if pacing) is the next datagram due? */
+bool DatagrumpSender::can_send()
 {
-  /* read and write from the receiver using an event-driven "poller" */
-  Poller poller;
+  if ( not sending_ or not window_is_open() ) {
+    return false;
+  }
+
+  if ( not pacing_ ) {
+    return true;
+  }
+
+  /* earn tokens at the pacing rate since the last refill */
+  const uint64_t now = timestamp_ns();
+  const double rate = controller_->pacing_rate();
+  pacing_tokens_ = rate > 0
+    ? min( pacing_tokens_ + (now - last_refill_) * rate / 1e9, PACING_BURST )
+    : PACING_BURST;
+  last_refill_ = now;
+
+  return pacing_tokens_ >= 1;
+}
+
+/* Wake up when the next token is earned, if the window would let us use it */
+void DatagrumpSender::schedule_pacing()
+{
+  const double rate = controller_->pacing_rate();
+
+  if ( sending_ and window_is_open() and rate > 0 and pacing_tokens_ < 1 ) {
+    pacing_timer_.arm_at( last_refill_ + (1 - pacing_tokens_) * 1e9 / rate );
+  } else {
+    pacing_timer_.disarm();
+  }
+}
+
+/* Wake up to send a probe if nothing happens for the controller's timeout */
+void DatagrumpSender::schedule_probe()
+{
+  const uint64_t deadline = sending_ ? last_activity_ + controller_->timeout_ms() * uint64_t( 1000000 ) : 0;
+  if ( deadline == probe_deadline_ ) {
+    return;
+  }
+
+  if ( deadline ) {
+    probe_timer_.arm_at( deadline );
+  } else {
+    probe_timer_.disarm();
+  }
+
+  probe_deadline_ = deadline;
+}
+
+void DatagrumpSender::schedule()
+{
+  if ( pacing_ ) {
+    schedule_pacing();
+  }
+
+  schedule_loss_detection();
+  schedule_probe();
+}
+
+void DatagrumpSender::set_trace( EventTrace * const trace, const uint16_t flow )
+{
+  trace_ = trace;
+  flow_ = flow;
+}
+
+void DatagrumpSender::set_schedule( const uint64_t start, const uint64_t stop )
+{
+  start_time_ = start;
+  stop_time_ = stop;
+}
+
+void DatagrumpSender::start( const uint64_t now )
+{
+  sending_ = true;
+  last_activity_ = now;
+  total_ = interval_ = Statistics( now );
+}
+
+void DatagrumpSender::stop( const uint64_t now, const unsigned int flow )
+{
+  sending_ = false;
+  stopped_ = true;
+
+  print_statistics( flow, total_, now, " overall" );
+}
+
+double DatagrumpSender::Statistics::throughput( const uint64_t now ) const
+{
+  return now > start ? datagrams_acked * datagram_size() * 8 * 1000.0 / (now - start) : 0;
+}
+
+void DatagrumpSender::print_statistics( const unsigned int flow, const Statistics & statistics,
+					const uint64_t now, const string & label ) const
+{
+  cout << "At time " << now / 1000000 << " ms flow " << flow << label << ": "
+       << statistics.throughput( now ) << " Mbit/s, "
+       << statistics.datagrams_sent << " sent, "
+       << statistics.datagrams_acked << " acked, "
+       << statistics.datagrams_lost << " lost, mean RTT "
+       << (statistics.rtt_samples ? statistics.rtt_sum / 1000.0 / statistics.rtt_samples : 0) << " ms" << endl;
+}
+
+double DatagrumpSender::report_interval( const uint64_t now, const unsigned int flow )
+{
+  print_statistics( flow, interval_, now, "" );
+  const double throughput = interval_.throughput( now );
+  interval_ = Statistics( now );
+  return throughput;
+}
+
+void DatagrumpSender::add_actions( Poller & poller )
+{
+  /* the socket polls as failed when the receiver has gone away (the
+     error is thrown, ending the flows), or, with transmit timestamps,
+     whenever some are waiting on its error queue */
+  const Poller::Action::CallbackType socket_failed = [&] () {
+    last_activity_ = timestamp_ns();
+    if ( transmit_timestamps_ ) {
+      got_transmit_timestamps();
+    } else {
+      socket_.check_error();
+    }
+    return ResultType::Continue;
+  };
 
   /* first rule: if the window is open, close it by
      sending more datagrams */
   poller.add_action( Action( socket_, Direction::Out, [&] () {
+	last_activity_ = timestamp_ns();
+
 	/* Close the window */
-	while ( window_is_open() ) {
-	  send_datagram( false );
+	if ( batch_ ) {
+	  send_burst();
+	} else {
+	  while ( can_send() ) {
+	    send_datagram( false );
+	  }
 	}
 	return ResultType::Continue;
       },
-      /* We're only interested in this rule when the window is open */
-      [&] () { return window_is_open(); } ) );
+      /* We're only interested in this rule when the window is open
+	 (and, if pacing, the next datagram is due) */
+      [&] () { return can_send(); },
+      socket_failed ) );
 
   /* second rule: if sender receives an ack,
      process it and inform the controller
      (by using the sender's got_ack method) */
   poller.add_action( Action( socket_, Direction::In, [&] () {
-	const UDPSocket::received_datagram recd = socket_.recv();
-	const ContestMessage ack  = recd.payload;
-	got_ack( recd.timestamp, ack );
+	last_activity_ = timestamp_ns();
+
+	/* drain every ack that is waiting with one syscall */
+	for ( auto & recd : socket_.recv_batch( ack_pool_, ACK_BATCH ) ) {
+	  got_ack( recd.timestamp, ContestMessageView( recd.payload.data(), recd.payload.size() ) );
+	}
 	return ResultType::Continue;
-      } ) );
+      },
+      std::function<bool(void)>(),
+      socket_failed ) );
 
-  /* Run these two rules forever */
-  while ( true ) {
-    const auto ret = poller.poll( controller_.timeout_ms() );
-    if ( ret.result == PollResult::Exit ) {
-      return ret.exit_status;
-    } else if ( ret.result == PollResult::Timeout ) {
-      /* After a timeout, send one datagram to try to get things moving again */
-      send_datagram( true );
-    }
+  /* third rule: if pacing, the timer says the next datagram is due
+     (the first rule will then find the window open) */
+  if ( pacing_ ) {
+    poller.add_action( Action( pacing_timer_, Direction::In, [&] () {
+	  last_activity_ = timestamp_ns();
+	  pacing_timer_.acknowledge();
+	  return ResultType::Continue;
+	} ) );
   }
+
+  /* fourth rule: a datagram has been out too long since a later one was acked */
+  poller.add_action( Action( loss_timer_, Direction::In, [&] () {
+	last_activity_ = timestamp_ns();
+	loss_timer_.acknowledge();
+	detect_losses( timestamp_us() );
+	return ResultType::Continue;
+      } ) );
+
+  /* fifth rule: nothing has happened for a timeout, so send one datagram
+     (a probe) to get things moving again: its ack shows what else was
+     lost, and reopens the window */
+  poller.add_action( Action( probe_timer_, Direction::In, [&] () {
+	last_activity_ = timestamp_ns();
+	probe_timer_.acknowledge();
+	if ( sending_ ) {
+	  trace( TraceEvent::Type::Timeout, 0, controller_->timeout_ms() );
+	  send_datagram( true );
+	}
+	return ResultType::Continue;
+      } ) );
 }
@@ -0,0 +1,147 @@
+/* discrete-event simulator: runs a congestion controller against
+   trace-driven links in virtual time (see simulation.hh), so a run
+   takes a fraction of the trace's length and comes out the same
+   every time (the sender, linkem and receiver in one process) */
+
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+
+#include <getopt.h>
+
+#include "simulation.hh"
+#include "controller_registry.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [--controller NAME[:KEY=VALUE,...]] [--pacing]"
+       << " [--ack-every N [--max-ack-delay MS]]"
+       << " [--delay MS] [--queue-packets N] [--queue-bytes N] [--uplink-log FILE]"
+       << " UPLINK_TRACE DOWNLINK_TRACE" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  string controller_spec = "delay", uplink_log_filename;
+  SimulationSettings settings; /* (a 20 ms delay by default, as in run-contest) */
+
+  const option command_line_options[] = {
+    { "controller",    required_argument, nullptr, 'c' },
+    { "pacing",        no_argument,       nullptr, 'P' },
+    { "ack-every",     required_argument, nullptr, 'a' },
+    { "max-ack-delay", required_argument, nullptr, 'm' },
+    { "delay",         required_argument, nullptr, 'd' },
+    { "queue-packets", required_argument, nullptr, 'p' },
+    { "queue-bytes",   required_argument, nullptr, 'b' },
+    { "uplink-log",    required_argument, nullptr, 'u' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "c:Pa:m:d:p:b:u:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'c':
+      controller_spec = optarg;
+      break;
+    case 'P':
+      settings.pacing = true;
+      break;
+    case 'a':
+      settings.ack_every = stoul( optarg );
+      break;
+    case 'm':
+      settings.max_ack_delay = stoull( optarg ) * 1000;
+      break;
+    case 'd':
+      settings.delay = stoull( optarg );
+      break;
+    case 'p':
+      settings.queue_packets = stoul( optarg );
+      break;
+    case 'b':
+      settings.queue_bytes = stoul( optarg );
+      break;
+    case 'u':
+      uplink_log_filename = optarg;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind != 2 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* pick the congestion controller: NAME, then any settings after a colon */
+  const size_t colon = controller_spec.find( ':' );
+  const string controller_name = controller_spec.substr( 0, colon );
+  const string controller_settings = colon == string::npos ? "" : controller_spec.substr( colon + 1 );
+
+  unique_ptr<Controller> controller;
+  try {
+    const ControllerType & type = find_controller_type( controller_name );
+    controller = type.make( controller_settings, false );
+    settings.pacing |= type.paced;
+  } catch ( const runtime_error & e ) {
+    cerr << argv[ 0 ] << ": " << e.what() << endl;
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  settings.uplink_trace = argv[ optind ];
+  settings.downlink_trace = argv[ optind + 1 ];
+
+  unique_ptr<ofstream> uplink_log;
+  if ( not uplink_log_filename.empty() ) {
+    for ( int i = 0; i < argc; i++ ) {
+      settings.command_line += string( i ? " " : "" ) + argv[ i ];
+    }
+
+    uplink_log.reset( new ofstream( uplink_log_filename ) );
+    settings.uplink_log = uplink_log.get();
+  }
+
+  const uint64_t start = timestamp_ns();
+  const SimulationResult result = run_simulation( settings, move( controller ) );
+  const double elapsed = (timestamp_ns() - start) / 1e9;
+
+  const double capacity = result.capacity(), throughput = result.throughput();
+
+  cout << fixed << setprecision( 2 );
+  cout << "Duration: " << result.duration / 1000.0 << " s (simulated in " << elapsed << " s)\n";
+  cout << "Average capacity: " << capacity << " Mbits/s\n";
+  cout << "Average throughput: " << throughput << " Mbits/s ("
+       << (capacity > 0 ? 100.0 * throughput / capacity : 0.0) << "% utilization)\n";
+  cout << "95th percentile per-packet queueing delay: " << result.p95_queueing_delay << " ms\n";
+  cout << "Packets delivered: " << result.packets_delivered
+       << ", dropped: " << result.packets_dropped << "\n";
+  cout << "Power score (throughput / 95th percentile delay incl. " << settings.delay << " ms base delay): "
+       << result.power( settings.delay ) << " Mbits/s^2\n";
+  cout << "Datagrams sent: " << result.datagrams_sent
+       << ", acked: " << result.datagrams_acked
+       << ", lost: " << result.datagrams_lost
+       << ", timeouts: " << result.timeouts
+       << ", mean RTT: "
+       << (result.rtt_samples ? result.rtt_sum / 1000.0 / result.rtt_samples : 0.0)
+       << " ms\n";
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,450 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "simulation.hh"
+#include "contest_message.hh"
+#include "scoreboard.hh"
+#include "link.hh"
+#include "delay_histogram.hh"
+
+using namespace std;
+
+/* bytes a datagram occupies on the link beyond its payload (as linkem counts them) */
+static const size_t PACKET_OVERHEAD = 20 + 8 + 4;
+
+/* Datagrams a paced sender may send back-to-back (as in sender.cc) */
+static const double PACING_BURST = 2;
+
+/* a time in milliseconds (from a Link) in microseconds, keeping "never" */
+static uint64_t ms_to_us( const uint64_t ms )
+{
+  return ms == uint64_t( -1 ) ? ms : ms * 1000;
+}
+
+static const string & dummy_payload()
+{
+  static const string payload( 1424, 'x' );
+  return payload;
+}
+
+/* Datagrams (and acks) the links can hold at once; each takes a
+   buffer from a pool of this many, and any sent while every buffer
+   is in use are dropped */
+static const size_t MAX_PACKETS = 65536;
+
+/* The sender's accounting for one flow, as DatagrumpSender does it
+   (all timestamps are in microseconds of virtual time) */
+class SimulatedSender
+{
+public:
+  struct Statistics
+  {
+    uint64_t datagrams_sent {}, datagrams_acked {}, datagrams_lost {}, timeouts {};
+    uint64_t rtt_sum {}, rtt_samples {};
+  };
+
+private:
+  PacketPool & pool_;
+  unique_ptr<Controller> controller_;
+
+  uint64_t sequence_number_; /* next outgoing sequence number */
+  Scoreboard scoreboard_;
+
+  /* the datagrams an ack covers (reused by each one) */
+  AckRanges ack_ranges_;
+
+  /* pace datagrams at the controller's rate (a token bucket) */
+  bool pacing_;
+  double pacing_tokens_;
+  uint64_t last_refill_;
+
+  /* send a probe if nothing has happened for the controller's timeout */
+  uint64_t last_activity_;
+
+  Statistics statistics_;
+
+  void send_datagram( const uint64_t now, const bool after_timeout, Link & uplink );
+  void detect_losses( const uint64_t now );
+  bool can_send( const uint64_t now );
+
+public:
+  SimulatedSender( PacketPool & pool, unique_ptr<Controller> && controller, const bool pacing );
+
+  /* an ack came off the downlink */
+  void got_ack( const uint64_t now, PacketPool::Buffer & ack );
+
+  /* handle whatever timers are due, then send what the window (and pacing) allow */
+  void act( const uint64_t now, Link & uplink );
+
+  /* when act() next has something to do (earlier than now: right away) */
+  uint64_t next_event_time();
+
+  const Statistics & statistics() const { return statistics_; }
+};
+
+/* The receiver's acks, as receiver.cc makes them: one per datagram, or
+   (with ack_every) aggregated, held for up to max_ack_delay */
+class SimulatedReceiver
+{
+private:
+  PacketPool & pool_;
+  unsigned int ack_every_; /* zero: ack each datagram by itself */
+
+  uint64_t sequence_number_; /* of the next ack */
+
+  /* the datagrams not yet acked */
+  AckRanges ranges_;
+  uint64_t bytes_;
+  ContestMessage::Header newest_;
+  uint64_t newest_recv_timestamp_;
+  uint64_t next_sequence_number_;
+  uint64_t deadline_; /* zero: nothing held */
+
+  void send_ack( const uint64_t now, Link & downlink );
+
+public:
+  SimulatedReceiver( PacketPool & pool, const unsigned int ack_every, const uint64_t max_ack_delay );
+
+  /* a datagram came off the uplink */
+  void receive( const uint64_t now, PacketPool::Buffer && datagram, Link & downlink );
+
+  /* send the held ack, if it is due */
+  void flush( const uint64_t now, Link & downlink );
+
+  uint64_t next_event_time() const { return deadline_ ? deadline_ : uint64_t( -1 ); }
+};
+
+SimulatedSender::SimulatedSender( PacketPool & pool, unique_ptr<Controller> && controller,
+				  const bool pacing )
+  : pool_( pool ),
+    controller_( move( controller ) ),
+    sequence_number_( 0 ),
+    scoreboard_(),
+    ack_ranges_( 0 ),
+    pacing_( pacing ),
+    pacing_tokens_( PACING_BURST ),
+    last_refill_( 0 ),
+    last_activity_( 0 ),
+    statistics_()
+{}
+
+void SimulatedSender::send_datagram( const uint64_t now, const bool after_timeout, Link & uplink )
+{
+  ContestMessage::Header header( sequence_number_++ );
+  header.send_timestamp = now;
+  header.ack_now = scoreboard_.in_flight() + 1 >= controller_->window_size();
+
+  const size_t size = ContestMessage::Header::WIRE_SIZE + dummy_payload().size();
+  PacketPool::Buffer datagram = pool_.try_acquire();
+  if ( datagram ) {
+    datagram.resize( size );
+    header.serialize( datagram.data() );
+    memcpy( datagram.data() + ContestMessage::Header::WIRE_SIZE, dummy_payload().data(), dummy_payload().size() );
+    uplink.enqueue( now / 1000, Link::Packet { move( datagram ), size + PACKET_OVERHEAD, 0 } );
+  } else {
+    uplink.drop( now / 1000, size + PACKET_OVERHEAD );
+  }
+
+  scoreboard_.sent( header.sequence_number, now, size );
+  statistics_.datagrams_sent++;
+
+  if ( pacing_ ) {
+    pacing_tokens_--;
+  }
+
+  /* Inform congestion controller */
+  controller_->datagram_was_sent( header.sequence_number, now, after_timeout );
+}
+
+void SimulatedSender::got_ack( const uint64_t now, PacketPool::Buffer & ack )
+{
+  last_activity_ = now;
+
+  const ContestMessageView view( ack.data(), ack.size() );
+  const ContestMessage::Header header = view.header();
+
+  /* Update the scoreboard with every datagram the ack covers (newest first) */
+  ack_ranges_.parse( view.payload(), view.payload_length() );
+  const AckRanges & ranges = ack_ranges_;
+
+  /* (the RTT leaves out how long the receiver held the ack) */
+  const uint64_t send_timestamp = header.ack_send_timestamp
+    + min( ranges.ack_delay(), now - header.ack_send_timestamp );
+
+  if ( ranges.empty() ) {
+    scoreboard_.acked( header.ack_sequence_number, now );
+  } else {
+    controller_->set_max_ack_delay( ranges.max_ack_delay() );
+
+    for ( auto range = ranges.ranges().rbegin(); range != ranges.ranges().rend(); range++ ) {
+      for ( uint64_t sequence_number = range->last + 1; sequence_number-- > range->first; ) {
+	scoreboard_.acked( sequence_number, now );
+      }
+    }
+  }
+
+  const unsigned int datagrams_acked = ranges.empty() ? 1 : ranges.count();
+  statistics_.datagrams_acked += datagrams_acked;
+  statistics_.rtt_sum += now - send_timestamp;
+  statistics_.rtt_samples++;
+
+  /* Inform congestion controller */
+  controller_->ack_received( header.ack_sequence_number,
+			    send_timestamp,
+			    header.ack_recv_timestamp,
+			    now,
+			    datagrams_acked );
+
+  detect_losses( now );
+}
+
+void SimulatedSender::detect_losses( const uint64_t now )
+{
+  for ( const auto sequence_number : scoreboard_.detect_losses( now ) ) {
+    statistics_.datagrams_lost++;
+    controller_->datagram_was_lost( sequence_number, now );
+  }
+}
+
+bool SimulatedSender::can_send( const uint64_t now )
+{
+  if ( scoreboard_.in_flight() >= controller_->window_size() ) {
+    return false;
+  }
+
+  if ( not pacing_ ) {
+    return true;
+  }
+
+  const double rate = controller_->pacing_rate();
+  pacing_tokens_ = rate > 0
+    ? min( pacing_tokens_ + (now - last_refill_) * rate / 1e6, PACING_BURST )
+    : PACING_BURST;
+  last_refill_ = now;
+
+  return pacing_tokens_ >= 1;
+}
+
+void SimulatedSender::act( const uint64_t now, Link & uplink )
+{
+  const bool timed_out = now >= last_activity_ + controller_->timeout_ms() * uint64_t( 1000 );
+  last_activity_ = now;
+
+  const uint64_t loss_time = scoreboard_.loss_time();
+  if ( loss_time and loss_time <= now ) {
+    detect_losses( now );
+  }
+
+  if ( timed_out ) {
+    statistics_.timeouts++;
+    send_datagram( now, true, uplink );
+  }
+
+  while ( can_send( now ) ) {
+    send_datagram( now, false, uplink );
+  }
+}
+
+uint64_t SimulatedSender::next_event_time()
+{
+  uint64_t ret = last_activity_ + controller_->timeout_ms() * uint64_t( 1000 );
+
+  const uint64_t loss_time = scoreboard_.loss_time();
+  if ( loss_time ) {
+    ret = min( ret, loss_time );
+  }
+
+  /* the next token, if the window would let us use it */
+  if ( scoreboard_.in_flight() < controller_->window_size() ) {
+    const double rate = controller_->pacing_rate();
+    if ( (not pacing_) or rate <= 0 or pacing_tokens_ >= 1 ) {
+      return last_activity_;
+    }
+
+    ret = min( ret, last_refill_ + uint64_t( ceil( (1 - pacing_tokens_) * 1e6 / rate ) ) );
+  }
+
+  return ret;
+}
+
+SimulatedReceiver::SimulatedReceiver( PacketPool & pool, const unsigned int ack_every,
+				      const uint64_t max_ack_delay )
+  : pool_( pool ),
+    ack_every_( ack_every ),
+    sequence_number_( 0 ),
+    ranges_( max_ack_delay ),
+    bytes_( 0 ),
+    newest_( 0 ),
+    newest_recv_timestamp_( 0 ),
+    next_sequence_number_( 0 ),
+    deadline_( 0 )
+{}
+
+void SimulatedReceiver::send_ack( const uint64_t now, Link & downlink )
+{
+  /* the header acks the newest datagram, the payload all of them */
+  ContestMessage::Header header = newest_;
+  header.ack_sequence_number = newest_.sequence_number;
+  header.sequence_number = sequence_number_++;
+  header.ack_send_timestamp = newest_.send_timestamp;
+  header.ack_recv_timestamp = newest_recv_timestamp_;
+  header.ack_payload_length = bytes_;
+  header.ack_now = false;
+  header.send_timestamp = now;
+  ranges_.set_ack_delay( now - newest_recv_timestamp_ );
+
+  const size_t size = ContestMessage::Header::WIRE_SIZE + ranges_.wire_size() + PACKET_OVERHEAD;
+  PacketPool::Buffer contents = pool_.try_acquire();
+  if ( contents ) {
+    contents.resize( ContestMessage::Header::WIRE_SIZE + ranges_.wire_size() );
+    header.serialize( contents.data() );
+    ranges_.serialize( contents.data() + ContestMessage::Header::WIRE_SIZE );
+    downlink.enqueue( now / 1000, Link::Packet { move( contents ), size, 0 } );
+  } else {
+    downlink.drop( now / 1000, size );
+  }
+
+  ranges_.clear();
+  bytes_ = 0;
+  deadline_ = 0;
+}
+
+void SimulatedReceiver::receive( const uint64_t now, PacketPool::Buffer && datagram, Link & downlink )
+{
+  ContestMessageView message( datagram.data(), datagram.size() );
+
+  if ( ack_every_ == 0 ) {
+    /* assemble the acknowledgment (in place, over the received header) */
+    message.transform_into_ack( sequence_number_++, now );
+
+    ContestMessage::Header header = message.header();
+    header.send_timestamp = now;
+    message.set_header( header );
+
+    datagram.resize( message.length() );
+    const size_t size = datagram.size() + PACKET_OVERHEAD;
+    downlink.enqueue( now / 1000, Link::Packet { move( datagram ), size, 0 } );
+    return;
+  }
+
+  const ContestMessage::Header header = message.header();
+
+  /* (one ack can only say so much) */
+  if ( not ranges_.add( header.sequence_number ) ) {
+    send_ack( now, downlink );
+    ranges_.add( header.sequence_number );
+  }
+
+  const bool in_order = header.sequence_number == next_sequence_number_;
+  next_sequence_number_ = max( next_sequence_number_, header.sequence_number + 1 );
+
+  bytes_ += message.payload_length();
+  newest_ = header;
+  newest_recv_timestamp_ = now;
+  if ( deadline_ == 0 ) {
+    deadline_ = now + ranges_.max_ack_delay();
+  }
+
+  if ( not in_order or header.ack_now or ranges_.count() >= ack_every_ ) {
+    send_ack( now, downlink );
+  }
+}
+
+void SimulatedReceiver::flush( const uint64_t now, Link & downlink )
+{
+  if ( deadline_ and deadline_ <= now ) {
+    send_ack( now, downlink );
+  }
+}
+
+double SimulationResult::capacity() const
+{
+  return duration ? capacity_bytes * 8.0 / duration / 1000.0 : 0.0;
+}
+
+double SimulationResult::throughput() const
+{
+  return duration ? delivered_bytes * 8.0 / duration / 1000.0 : 0.0;
+}
+
+double SimulationResult::power( const uint64_t base_delay ) const
+{
+  const uint64_t total_delay = p95_queueing_delay + base_delay;
+  return total_delay ? throughput() / (total_delay / 1000.0) : 0.0;
+}
+
+SimulationResult run_simulation( const SimulationSettings & settings,
+				 unique_ptr<Controller> && controller )
+{
+  PacketPool pool( MAX_PACKETS, ContestMessage::Header::WIRE_SIZE + dummy_payload().size() );
+
+  Link uplink( settings.uplink_trace, settings.delay, false ),
+    downlink( settings.downlink_trace, settings.delay, true );
+  uplink.set_queue_limits( settings.queue_packets, settings.queue_bytes );
+  downlink.set_queue_limits( settings.queue_packets, settings.queue_bytes );
+
+  if ( settings.uplink_log ) {
+    uplink.set_log( *settings.uplink_log, "uplink", settings.uplink_trace, settings.command_line, 0 );
+  }
+
+  SimulatedSender sender( pool, move( controller ), settings.pacing );
+  SimulatedReceiver receiver( pool, settings.ack_every, settings.max_ack_delay );
+
+  SimulationResult result;
+  DelayHistogram queueing_delays;
+
+  /* Run each event at its time (in microseconds), until the uplink
+     trace runs out and the last datagram through it has arrived */
+  uint64_t now = 0;
+  while ( not (uplink.finished() and uplink.next_event_time() == uint64_t( -1 )) ) {
+    const uint64_t now_ms = now / 1000;
+
+    uplink.advance( now_ms );
+    downlink.advance( now_ms );
+    if ( uplink.finished() and result.duration == 0 ) {
+      result.duration = now_ms;
+    }
+
+    while ( uplink.has_output( now_ms ) ) {
+      Link::Packet packet = uplink.pop_output();
+      queueing_delays.add( now_ms - settings.delay - packet.arrival_time );
+      result.delivered_bytes += packet.size;
+      receiver.receive( now, move( packet.contents ), downlink );
+    }
+    receiver.flush( now, downlink );
+
+    bool acked = false;
+    while ( downlink.has_output( now_ms ) ) {
+      Link::Packet ack = downlink.pop_output();
+      sender.got_ack( now, ack.contents );
+      acked = true;
+    }
+
+    if ( acked or sender.next_event_time() <= now ) {
+      sender.act( now, uplink );
+    }
+
+    /* on to the next event (never staying put, which could loop forever) */
+    const uint64_t next = min( { ms_to_us( uplink.next_event_time() ),
+				 ms_to_us( downlink.next_event_time() ),
+				 receiver.next_event_time(),
+				 sender.next_event_time() } );
+    now = max( next, now + 1 );
+  }
+
+  result.capacity_bytes = uplink.capacity_bytes();
+  result.p95_queueing_delay = queueing_delays.percentile( 0.95 );
+  result.packets_delivered = queueing_delays.total();
+  result.packets_dropped = uplink.dropped_packets();
+
+  const SimulatedSender::Statistics & statistics = sender.statistics();
+  result.datagrams_sent = statistics.datagrams_sent;
+  result.datagrams_acked = statistics.datagrams_acked;
+  result.datagrams_lost = statistics.datagrams_lost;
+  result.timeouts = statistics.timeouts;
+  result.rtt_sum = statistics.rtt_sum;
+  result.rtt_samples = statistics.rtt_samples;
+
+  return result;
+}
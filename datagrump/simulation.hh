@@ -0,0 +1,54 @@
+#ifndef SIMULATION_HH
+#define SIMULATION_HH
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <ostream>
+
+#include "controller.hh"
+
+/* A discrete-event simulation of one flow: the sender's accounting
+   around a controller, trace-driven links in each direction, and the
+   receiver's acks, run in virtual time with no sockets or clock (so
+   it is quick, the same every run, and safe to run on many threads) */
+
+struct SimulationSettings
+{
+  std::string uplink_trace {}, downlink_trace {}; /* the uplink plays once */
+  uint64_t delay = 20;                            /* one-way, in milliseconds */
+  size_t queue_packets = 0, queue_bytes = 0;      /* zero: unlimited */
+  bool pacing = false;
+  unsigned int ack_every = 0;                     /* zero: ack each datagram */
+  uint64_t max_ack_delay = 5000;                  /* in microseconds */
+
+  /* log the uplink in mahimahi's format (if not null) */
+  std::ostream * uplink_log = nullptr;
+  std::string command_line {};
+};
+
+/* what the uplink delivered (as analyze would count it from the log),
+   and what the sender saw */
+struct SimulationResult
+{
+  uint64_t duration {};        /* in milliseconds */
+  uint64_t capacity_bytes {}, delivered_bytes {};
+  uint64_t p95_queueing_delay {}; /* in milliseconds */
+  uint64_t packets_delivered {}, packets_dropped {};
+
+  uint64_t datagrams_sent {}, datagrams_acked {}, datagrams_lost {}, timeouts {};
+  uint64_t rtt_sum {}, rtt_samples {}; /* in microseconds */
+
+  /* in Mbit/s */
+  double capacity() const;
+  double throughput() const;
+
+  /* throughput over the 95th-percentile delay, including base_delay (ms) */
+  double power( const uint64_t base_delay ) const;
+};
+
+/* run the controller over the settings' traces */
+SimulationResult run_simulation( const SimulationSettings & settings,
+				 std::unique_ptr<Controller> && controller );
+
+#endif /* SIMULATION_HH */
@@ -0,0 +1,247 @@
+/* parameter sweep: simulates (see simulation.hh) every combination of
+   controller settings in a grid, on every core at once, and prints
+   the runs that make up the Pareto frontier of throughput and delay */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <getopt.h>
+
+#include "simulation.hh"
+#include "controller_registry.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* one point of the grid, and how it did */
+struct Run
+{
+  string controller_spec;
+  SimulationResult result;
+  string error;
+  bool frontier;
+};
+
+/* split a string at each separator */
+static vector<string> split( const string & str, const char separator )
+{
+  vector<string> ret;
+  size_t start = 0;
+  while ( true ) {
+    const size_t end = str.find( separator, start );
+    ret.push_back( str.substr( start, end - start ) );
+    if ( end == string::npos ) {
+      return ret;
+    }
+    start = end + 1;
+  }
+}
+
+/* expand "NAME:KEY=A/B,KEY=C/D" into a controller spec for each combination */
+static vector<string> expand_grid( const string & grid )
+{
+  const size_t colon = grid.find( ':' );
+  vector<string> ret = { grid.substr( 0, colon ) };
+  if ( colon == string::npos ) {
+    return ret;
+  }
+
+  bool first = true;
+  for ( const auto & setting : split( grid.substr( colon + 1 ), ',' ) ) {
+    const size_t equals = setting.find( '=' );
+    if ( equals == string::npos ) {
+      throw runtime_error( "grid setting \"" + setting + "\" is not KEY=VALUE[/VALUE...]" );
+    }
+
+    const string key = setting.substr( 0, equals );
+    vector<string> expanded;
+    for ( const auto & spec : ret ) {
+      for ( const auto & value : split( setting.substr( equals + 1 ), '/' ) ) {
+	expanded.push_back( spec + (first ? ":" : ",") + key + "=" + value );
+      }
+    }
+    ret = move( expanded );
+    first = false;
+  }
+
+  return ret;
+}
+
+/* create the controller a spec names, and whether it paces */
+static unique_ptr<Controller> make_controller( const string & controller_spec, bool & paced )
+{
+  const size_t colon = controller_spec.find( ':' );
+  const ControllerType & type = find_controller_type( controller_spec.substr( 0, colon ) );
+  paced = type.paced;
+  return type.make( colon == string::npos ? "" : controller_spec.substr( colon + 1 ), false );
+}
+
+/* mark the runs no other run beats on both throughput and delay
+   (sorting them best throughput first) */
+static void find_frontier( vector<Run> & runs )
+{
+  sort( runs.begin(), runs.end(), [] ( const Run & a, const Run & b ) {
+      if ( a.result.throughput() != b.result.throughput() ) {
+	return a.result.throughput() > b.result.throughput();
+      }
+      return a.result.p95_queueing_delay < b.result.p95_queueing_delay;
+    } );
+
+  uint64_t best_delay = -1;
+  for ( auto & run : runs ) {
+    run.frontier = run.error.empty() and run.result.p95_queueing_delay < best_delay;
+    if ( run.frontier ) {
+      best_delay = run.result.p95_queueing_delay;
+    }
+  }
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [--jobs N] [--all] [--pacing] [--ack-every N [--max-ack-delay MS]]"
+       << " [--delay MS] [--queue-packets N] [--queue-bytes N]"
+       << " UPLINK_TRACE DOWNLINK_TRACE NAME[:KEY=VALUE[/VALUE...],...]..." << endl;
+  cerr << "  (each grid runs every combination of the values given; e.g. aimd:increase=0.5/1/2,decrease=0.5/0.7)" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  SimulationSettings settings;
+  unsigned int jobs = max( thread::hardware_concurrency(), 1U );
+  bool all = false;
+
+  const option command_line_options[] = {
+    { "jobs",          required_argument, nullptr, 'j' },
+    { "all",           no_argument,       nullptr, 'A' },
+    { "pacing",        no_argument,       nullptr, 'P' },
+    { "ack-every",     required_argument, nullptr, 'a' },
+    { "max-ack-delay", required_argument, nullptr, 'm' },
+    { "delay",         required_argument, nullptr, 'd' },
+    { "queue-packets", required_argument, nullptr, 'p' },
+    { "queue-bytes",   required_argument, nullptr, 'b' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "j:APa:m:d:p:b:", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'j':
+      jobs = stoul( optarg );
+      break;
+    case 'A':
+      all = true;
+      break;
+    case 'P':
+      settings.pacing = true;
+      break;
+    case 'a':
+      settings.ack_every = stoul( optarg );
+      break;
+    case 'm':
+      settings.max_ack_delay = stoull( optarg ) * 1000;
+      break;
+    case 'd':
+      settings.delay = stoull( optarg );
+      break;
+    case 'p':
+      settings.queue_packets = stoul( optarg );
+      break;
+    case 'b':
+      settings.queue_bytes = stoul( optarg );
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind < 3 or jobs == 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  settings.uplink_trace = argv[ optind ];
+  settings.downlink_trace = argv[ optind + 1 ];
+
+  /* every point of every grid (checking each names a controller and its settings) */
+  vector<Run> runs;
+  try {
+    for ( int i = optind + 2; i < argc; i++ ) {
+      for ( const auto & controller_spec : expand_grid( argv[ i ] ) ) {
+	bool paced;
+	make_controller( controller_spec, paced );
+	runs.push_back( Run { controller_spec, SimulationResult(), "", false } );
+      }
+    }
+  } catch ( const runtime_error & e ) {
+    cerr << argv[ 0 ] << ": " << e.what() << endl;
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  jobs = min( jobs, unsigned( runs.size() ) );
+  cerr << "Simulating " << runs.size() << " runs on " << jobs << " threads" << endl;
+  const uint64_t start = timestamp_ns();
+
+  /* each thread takes the next run until there are none left
+     (the runs share nothing, so this is all the coordination needed) */
+  atomic<size_t> next_run( 0 );
+  vector<thread> threads;
+  for ( unsigned int i = 0; i < jobs; i++ ) {
+    threads.emplace_back( [&] () {
+	for ( size_t n = next_run++; n < runs.size(); n = next_run++ ) {
+	  Run & run = runs[ n ];
+	  try {
+	    SimulationSettings run_settings = settings;
+	    bool paced;
+	    unique_ptr<Controller> controller = make_controller( run.controller_spec, paced );
+	    run_settings.pacing |= paced;
+	    run.result = run_simulation( run_settings, move( controller ) );
+	  } catch ( const exception & e ) {
+	    run.error = e.what();
+	  }
+	}
+      } );
+  }
+
+  for ( auto & thread : threads ) {
+    thread.join();
+  }
+
+  cerr << "Done in " << fixed << setprecision( 2 ) << (timestamp_ns() - start) / 1e9 << " s" << endl;
+
+  find_frontier( runs );
+
+  /* one tab-separated line per run, best throughput first */
+  cout << "# throughput_mbps\tp95_queueing_delay_ms\tpower\tfrontier\tcontroller\n";
+  for ( const auto & run : runs ) {
+    if ( not run.error.empty() ) {
+      cerr << run.controller_spec << ": " << run.error << endl;
+    } else if ( all or run.frontier ) {
+      cout << fixed << setprecision( 2 )
+	   << run.result.throughput() << "\t"
+	   << run.result.p95_queueing_delay << "\t"
+	   << run.result.power( settings.delay ) << "\t"
+	   << (run.frontier ? "yes" : "no") << "\t"
+	   << run.controller_spec << "\n";
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+/* decode a sender's event trace (see event_trace.hh) into text,
+   one tab-separated line per event */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "event_trace.hh"
+#include "file_descriptor.hh"
+#include "util.hh"
+
+using namespace std;
+
+static const char * type_name( const TraceEvent::Type type )
+{
+  switch ( type ) {
+  case TraceEvent::Type::Sent:        return "sent";
+  case TraceEvent::Type::Transmitted: return "transmitted";
+  case TraceEvent::Type::Acked:       return "acked";
+  case TraceEvent::Type::RTTSample:   return "rtt";
+  case TraceEvent::Type::Lost:        return "lost";
+  case TraceEvent::Type::Timeout:     return "timeout";
+  case TraceEvent::Type::Window:      return "window";
+  case TraceEvent::Type::Dropped:     return "dropped";
+  }
+
+  return "unknown";
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " TRACEFILE" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 2 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* map the whole trace */
+  FileDescriptor trace( SystemCall( argv[ 1 ], open( argv[ 1 ], O_RDONLY ) ) );
+  struct stat trace_stat;
+  SystemCall( "fstat", fstat( trace.fd_num(), &trace_stat ) );
+
+  const size_t size = trace_stat.st_size;
+  if ( size < EventTrace::MAGIC.size() ) {
+    cerr << argv[ 1 ] << ": not an event trace" << endl;
+    return EXIT_FAILURE;
+  }
+
+  void * const mapping = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, trace.fd_num(), 0 );
+  if ( mapping == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  madvise( mapping, size, MADV_SEQUENTIAL );
+
+  const char * const contents = static_cast<const char *>( mapping );
+  if ( EventTrace::MAGIC.compare( 0, string::npos, contents, EventTrace::MAGIC.size() ) ) {
+    cerr << argv[ 1 ] << ": not an event trace" << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << "# time_ns\tflow\tevent\tsequence_number\tcount\tvalue\n";
+
+  /* (a trace cut short by a crash may end in part of an event) */
+  for ( size_t offset = EventTrace::MAGIC.size(); offset + sizeof( TraceEvent ) <= size;
+	offset += sizeof( TraceEvent ) ) {
+    TraceEvent event;
+    memcpy( &event, contents + offset, sizeof( event ) );
+
+    cout << event.timestamp << '\t' << event.flow << '\t' << type_name( event.type ) << '\t'
+	 << event.sequence_number << '\t' << event.count << '\t' << event.value << '\n';
+  }
+
+  SystemCall( "munmap", munmap( mapping, size ) );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+#ifndef WINDOWED_FILTER_HH
+#define WINDOWED_FILTER_HH
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <functional>
+
+/* best (e.g. minimum or maximum) of the samples seen in the last
+   `window` time units. Samples that can never be the best again are
+   dropped as they arrive, so updates are amortized O(1). */
+
+template <class T, class Better>
+class WindowedFilter
+{
+private:
+  uint64_t window_;
+  std::deque<std::pair<uint64_t, T>> samples_ {}; /* (time, sample), best first */
+
+public:
+  WindowedFilter( const uint64_t window ) : window_( window ) {}
+
+  void set_window( const uint64_t window ) { window_ = window; }
+
+  void update( const uint64_t now, const T & sample )
+  {
+    /* a newer, at-least-as-good sample outlives the ones behind it */
+    while ( not samples_.empty() and not Better()( samples_.back().second, sample ) ) {
+      samples_.pop_back();
+    }
+    samples_.emplace_back( now, sample );
+
+    /* forget samples that have left the window */
+    while ( samples_.front().first + window_ < now ) {
+      samples_.pop_front();
+    }
+  }
+
+  bool empty() const { return samples_.empty(); }
+
+  const T & best() const { return samples_.front().second; }
+
+  void reset() { samples_.clear(); }
+};
+
+template <class T>
+using WindowedMinFilter = WindowedFilter<T, std::less<T>>;
+
+template <class T>
+using WindowedMaxFilter = WindowedFilter<T, std::greater<T>>;
+
+#endif /* WINDOWED_FILTER_HH */
@@ -1,13 +1,18 @@
 #include <iostream>
 #include <thread>
+#include <vector>
 
 #include "socket.hh"
 #include "util.hh"
 #include "poller.hh"
+#include "ring_buffer.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+/* the most each read takes (into a buffer that is reused) */
+static const size_t READ_SIZE = 65536;
+
 int main( int argc, char *argv[] )
 {
   /* check the command-line arguments */
@@ -37,12 +42,16 @@ int main( int argc, char *argv[] )
 
   /* now read and write from the server using an event-driven "poller" */
   Poller poller;
+  vector<char> buffer( READ_SIZE );
+
+  /* what we've typed, waiting for the server to take it */
+  RingBuffer output( 4 * READ_SIZE );
 
   /* first rule: if the socket has data ready (in the "In" direction),
      print it to the screen (cout) */
   poller.add_action( Action( socket, Direction::In,
 			     [&] () {
-			       cout << socket.read();
+			       cout.write( &buffer[ 0 ], socket.read( &buffer[ 0 ], buffer.size() ) );
 
 			       /* exit if the server closes the connection */
 			       if ( socket.eof() ) {
@@ -53,13 +62,32 @@ int main( int argc, char *argv[] )
 			     } ) );
 
   /* second rule: if the keyboard has data ready (also in the "In" direction),
-     write it to the server, plus a carriage return and newline */
+     queue it for the server, plus a carriage return and newline
+     (unless there isn't room, because the server isn't taking it) */
   FileDescriptor keyboard( 0 );
-  poller.add_action( Action( keyboard, Direction::In,
+  const auto typed = [&] () {
+    const size_t length = keyboard.read( &buffer[ 0 ], buffer.size() );
+    if ( length ) {
+      output.push( &buffer[ 0 ], length );
+      output.push( "\r\n", 2 );
+    }
+    return ResultType::Continue;
+  };
+
+  /* (a hangup, if stdin is a pipe, means read what's left until EOF;
+     what was typed still goes to the server) */
+  poller.add_action( Action( keyboard, Direction::In, typed,
+			     [&] () { return output.space() >= READ_SIZE + 2; },
+			     typed ) );
+
+  /* third rule: if the server can take more (in the "Out" direction),
+     write what's queued */
+  poller.add_action( Action( socket, Direction::Out,
 			     [&] () {
-			       socket.write( keyboard.read() + "\r\n" );
+			       output.write_to( socket );
 			       return ResultType::Continue;
-			     } ) );
+			     },
+			     [&] () { return not output.empty(); } ) );
 
   /* run these two rules forever until it's time to quit */
   while ( true ) {
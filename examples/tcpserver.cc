@@ -3,11 +3,226 @@
 
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <cstdio>
+
+#include <getopt.h>
+#include <sys/eventfd.h>
 
 #include "socket.hh"
 #include "util.hh"
+#include "poller.hh"
+#include "ring_buffer.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* counters shared by every thread, reported once a second */
+struct Statistics
+{
+  atomic<uint64_t> connections { 0 };
+  atomic<uint64_t> bytes { 0 };
+};
+
+/* the most each read takes from a client (into a buffer that is reused) */
+static const size_t READ_SIZE = 65536;
+
+/* write the reply to a read of length bytes into reply (returns its length) */
+static size_t format_reply( char ( &reply )[ 64 ], const size_t length )
+{
+  return snprintf( reply, sizeof( reply ), "Received %zu bytes from you.\n", length );
+}
+
+/* in the reactor, each connection's replies wait in a buffer this big
+   until the client takes them; while it's over OUTPUT_LIMIT, we stop
+   reading from that client (so one slow reader can't make us buffer
+   without bound, or block the worker) */
+static const size_t OUTPUT_CAPACITY = 65536;
+static const size_t OUTPUT_LIMIT = OUTPUT_CAPACITY - 256;
+
+/* a reactor thread: one Poller serving many connections */
+class Worker
+{
+private:
+  Statistics & stats_;
+  Poller poller_;
+
+  /* connections handed over by the acceptor thread, and an eventfd to wake us up */
+  FileDescriptor wakeup_;
+  mutex incoming_mutex_;
+  queue<TCPSocket> incoming_;
+
+  struct Connection
+  {
+    TCPSocket socket;
+    string name;
+    RingBuffer output;
+  };
+
+  list<Connection> connections_;
+  vector<list<Connection>::iterator> closed_;
+
+  /* every read goes here (and is printed before the next one) */
+  vector<char> buffer_;
+
+  void add_connection( TCPSocket && client );
+  void close_connection( const list<Connection>::iterator & connection );
+
+public:
+  Worker( Statistics & stats );
+
+  /* called from the acceptor thread */
+  void hand_off( TCPSocket && client );
+
+  /* accept connections directly (each worker has its own SO_REUSEPORT socket) */
+  void listen_on( TCPSocket & listening_socket );
+
+  void run();
+};
+
+Worker::Worker( Statistics & stats )
+  : stats_( stats ),
+    poller_( Poller::Backend::Epoll ),
+    wakeup_( SystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC ) ) ),
+    incoming_mutex_(),
+    incoming_(),
+    connections_(),
+    closed_(),
+    buffer_( READ_SIZE )
+{
+  /* take over connections queued by the acceptor */
+  poller_.add_action( Action( wakeup_, Direction::In,
+			      [&] () {
+				uint64_t count;
+				wakeup_.read( reinterpret_cast<char *>( &count ), sizeof( count ) );
+
+				lock_guard<mutex> lock( incoming_mutex_ );
+				while ( not incoming_.empty() ) {
+				  add_connection( move( incoming_.front() ) );
+				  incoming_.pop();
+				}
+				return ResultType::Continue;
+			      } ) );
+}
+
+void Worker::hand_off( TCPSocket && client )
+{
+  {
+    lock_guard<mutex> lock( incoming_mutex_ );
+    incoming_.push( move( client ) );
+  }
+
+  const uint64_t one = 1;
+  wakeup_.write( reinterpret_cast<const char *>( &one ), sizeof( one ) );
+}
+
+void Worker::listen_on( TCPSocket & listening_socket )
+{
+  poller_.add_action( Action( listening_socket, Direction::In,
+			      [&] () {
+				add_connection( listening_socket.accept() );
+				return ResultType::Continue;
+			      } ) );
+}
+
+void Worker::add_connection( TCPSocket && client )
+{
+  stats_.connections++;
+
+  /* the poller says when each socket is ready, so no call may block the worker */
+  client.set_blocking( false );
+
+  connections_.push_back( Connection { move( client ), string(), RingBuffer( OUTPUT_CAPACITY ) } );
+  const auto connection = prev( connections_.end() );
+  connection->name = connection->socket.peer_address().to_string();
+
+  cerr << "New connection from " << connection->name << endl;
+
+  /* a reset connection shouldn't stop the other ones */
+  const auto failed = [this, connection] () {
+    close_connection( connection );
+    return ResultType::Cancel;
+  };
+
+  /* Print every line that the client sends, and queue a reply
+     (unless the client isn't taking its replies) */
+  poller_.add_action( Action( connection->socket, Direction::In,
+			      [this, connection] () {
+				TCPSocket & client = connection->socket;
+
+				size_t length;
+				try {
+				  length = client.read( &buffer_[ 0 ], buffer_.size() );
+				} catch ( const unix_error & e ) {
+				  print_exception( e );
+				  close_connection( connection );
+				  return ResultType::Cancel;
+				}
+
+				if ( client.eof() ) {
+				  close_connection( connection );
+				  return ResultType::Cancel;
+				}
+
+				stats_.bytes += length;
+				cerr << "Got " << length << " bytes from "
+				     << connection->name << ": ";
+				cerr.write( &buffer_[ 0 ], length );
+				char reply[ 64 ];
+				connection->output.push( reply, format_reply( reply, length ) );
+				return ResultType::Continue;
+			      },
+			      [connection] () { return connection->output.size() <= OUTPUT_LIMIT; },
+			      failed ) );
+
+  /* send the queued replies as the client takes them */
+  poller_.add_action( Action( connection->socket, Direction::Out,
+			      [this, connection] () {
+				try {
+				  connection->output.write_to( connection->socket );
+				} catch ( const unix_error & e ) {
+				  print_exception( e );
+				  close_connection( connection );
+				  return ResultType::Cancel;
+				}
+				return ResultType::Continue;
+			      },
+			      [connection] () { return not connection->output.empty(); },
+			      failed ) );
+}
+
+/* the connection is closed once the poller has forgotten it (after poll returns) */
+void Worker::close_connection( const list<Connection>::iterator & connection )
+{
+  cerr << connection->name << " closed the connection." << endl;
+  poller_.remove_actions( connection->socket );
+  closed_.push_back( connection );
+}
+
+void Worker::run()
+{
+  while ( true ) {
+    const auto ret = poller_.poll( -1 );
+    if ( ret.result == PollResult::Exit ) {
+      return;
+    }
+
+    for ( const auto & connection : closed_ ) {
+      connections_.erase( connection );
+    }
+    closed_.clear();
+  }
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " [--workers N [--reuseport]] PORT" << endl;
+}
 
 int main( int argc, char *argv[] )
 {
@@ -16,53 +231,149 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  unsigned int worker_count = 0;
+  bool reuseport = false;
+
+  const option command_line_options[] = {
+    { "workers",   required_argument, nullptr, 'w' },
+    { "reuseport", no_argument,       nullptr, 'r' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "w:r", command_line_options, nullptr );
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'w':
+      worker_count = stoul( optarg );
+      break;
+    case 'r':
+      reuseport = true;
+      break;
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( argc - optind != 1 or (reuseport and worker_count == 0) ) {
+    usage( argv[ 0 ] );
     return EXIT_FAILURE;
   }
 
-  /* create a TCP socket */
-  TCPSocket listening_socket;
+  const Address local_address( "::0", argv[ optind ] );
 
-  /* it's ok to reuse the server's address as soon as the program quits
-     (this helps debugging, at the slight cost to robustness) */
-  listening_socket.set_reuseaddr();
+  /* with SO_REUSEPORT, every worker gets its own listening socket
+     and the kernel spreads new connections across them */
+  list<TCPSocket> listening_sockets;
+  for ( unsigned int i = 0; i < (reuseport ? worker_count : 1); i++ ) {
+    /* create a TCP socket */
+    listening_sockets.emplace_back();
+    TCPSocket & listening_socket = listening_sockets.back();
 
-  /* "bind" the socket to the user-specified local port number */
-  listening_socket.bind( Address( "::0", argv[ 1 ] ) );
+    /* it's ok to reuse the server's address as soon as the program quits
+       (this helps debugging, at the slight cost to robustness) */
+    listening_socket.set_reuseaddr();
 
-  /* mark the socket as listening for incoming connections */
-  listening_socket.listen();
-  cerr << "Listening on local address: " << listening_socket.local_address().to_string() << endl;
+    if ( reuseport ) {
+      listening_socket.set_reuseport();
+    }
 
-  /* Wait for clients to connect */
-  while ( true ) {
+    /* "bind" the socket to the user-specified local port number */
+    listening_socket.bind( local_address );
+
+    /* mark the socket as listening for incoming connections */
+    listening_socket.listen( 1024 );
+  }
+
+  cerr << "Listening on local address: "
+       << listening_sockets.front().local_address().to_string() << endl;
+
+  /* report connections and bytes per second, to compare server models */
+  Statistics stats;
+  thread reporter( [&stats] () {
+      uint64_t last_connections = 0, last_bytes = 0;
+      while ( true ) {
+	this_thread::sleep_for( chrono::seconds( 1 ) );
+	const uint64_t connections = stats.connections, bytes = stats.bytes;
+	cerr << "[stats] " << connections - last_connections << " connections/s, "
+	     << bytes - last_bytes << " bytes/s" << endl;
+	last_connections = connections;
+	last_bytes = bytes;
+      }
+    } );
+  reporter.detach();
+
+  TCPSocket & listening_socket = listening_sockets.front();
 
-    /* This line does a lot. It waits for a client to connect
-       ("listening_socket.accept()"). When that returns a new socket,
-       it starts a thread to handle that client and passes in the
-       result of accept() as the "client" parameter to the handler. */
+  if ( worker_count == 0 ) {
+    /* Wait for clients to connect */
+    while ( true ) {
 
-    thread client_handler( [] ( TCPSocket client ) {
-	cerr << "New connection from " << client.peer_address().to_string() << endl;
+      /* This line does a lot. It waits for a client to connect
+	 ("listening_socket.accept()"). When that returns a new socket,
+	 it starts a thread to handle that client and passes in the
+	 result of accept() as the "client" parameter to the handler. */
 
-	/* Print every line that the client sends */
-	while ( true ) {
-	  const string chunk = client.read();
-	  if ( client.eof() ) { break; }
-	  cerr << "Got " << chunk.size() << " bytes from "
-	       << client.peer_address().to_string() << ": " << chunk;
-	  client.write( "Received " + to_string( chunk.size() ) + " bytes from you.\n" );
-	}
+      thread client_handler( [&stats] ( TCPSocket client ) {
+	  stats.connections++;
+	  cerr << "New connection from " << client.peer_address().to_string() << endl;
 
-	cerr << client.peer_address().to_string() << " closed the connection." << endl; 
-      }, listening_socket.accept() );
+	  /* Print every line that the client sends */
+	  vector<char> buffer( READ_SIZE );
+	  char reply[ 64 ];
+	  while ( true ) {
+	    const size_t length = client.read( &buffer[ 0 ], buffer.size() );
+	    if ( client.eof() ) { break; }
+	    stats.bytes += length;
+	    cerr << "Got " << length << " bytes from "
+		 << client.peer_address().to_string() << ": ";
+	    cerr.write( &buffer[ 0 ], length );
+	    client.write( reply, format_reply( reply, length ) );
+	  }
 
-    /* Let the client handler continue to run without having
-       to keep track of it. The main thread can go back to accepting
-       new incoming connections. */
+	  cerr << client.peer_address().to_string() << " closed the connection." << endl;
+	}, listening_socket.accept() );
+
+      /* Let the client handler continue to run without having
+	 to keep track of it. The main thread can go back to accepting
+	 new incoming connections. */
+
+      client_handler.detach();
+    }
+  }
+
+  /* reactor model: a fixed pool of threads, each running a Poller */
+  list<Worker> workers;
+  list<thread> threads;
+  auto listener = listening_sockets.begin();
+  for ( unsigned int i = 0; i < worker_count; i++ ) {
+    workers.emplace_back( stats );
+    if ( reuseport ) {
+      workers.back().listen_on( *listener++ );
+    }
+  }
+
+  for ( auto & worker : workers ) {
+    threads.emplace_back( [&worker] () { worker.run(); } );
+  }
+
+  if ( not reuseport ) {
+    /* accept here and hand each connection to the next worker in turn */
+    auto next_worker = workers.begin();
+    while ( true ) {
+      next_worker->hand_off( listening_socket.accept() );
+      if ( ++next_worker == workers.end() ) {
+	next_worker = workers.begin();
+      }
+    }
+  }
 
-    client_handler.detach();
+  for ( auto & thread : threads ) {
+    thread.join();
   }
 
   return EXIT_SUCCESS;
@@ -140,3 +140,16 @@ bool Address::operator==( const Address & other ) const
 {
   return 0 == memcmp( &addr_, &other.addr_, size_ );
 }
+
+/* hash the same bytes that equality compares (FNV-1a) */
+size_t Address::Hash::operator()( const Address & address ) const
+{
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *>( &address.addr_ );
+
+  uint64_t hash = 14695981039346656037ULL;
+  for ( socklen_t i = 0; i < address.size_; i++ ) {
+    hash = (hash ^ bytes[ i ]) * 1099511628211ULL;
+  }
+
+  return hash;
+}
@@ -47,6 +47,12 @@ public:
 
   /* equality */
   bool operator==( const Address & other ) const;
+
+  /* hash, for unordered containers keyed by Address */
+  struct Hash
+  {
+    size_t operator()( const Address & address ) const;
+  };
 };
 
 #endif /* ADDRESS_HH */
@@ -2,6 +2,7 @@
 #include "util.hh"
 
 #include <unistd.h>
+#include <fcntl.h>
 
 using namespace std;
 
@@ -38,47 +39,86 @@ FileDescriptor::~FileDescriptor()
   }
 }
 
-/* attempt to write a portion of a string */
-string::const_iterator FileDescriptor::write( const string::const_iterator & begin,
-					      const string::const_iterator & end )
+/* read method */
+string FileDescriptor::read( const size_t limit )
 {
-  if ( begin >= end ) {
-    throw runtime_error( "nothing to write" );
-  }
+  char buffer[ BUFFER_SIZE ];
 
-  ssize_t bytes_written = SystemCall( "write", ::write( fd_, &*begin, end - begin ) );
-  if ( bytes_written == 0 ) {
-    throw runtime_error( "write returned 0" );
+  return string( buffer, read( buffer, min( BUFFER_SIZE, limit ) ) );
+}
+
+/* write method */
+string::const_iterator FileDescriptor::write( const std::string & buffer, const bool write_all )
+{
+  return buffer.begin() + write( buffer.data(), buffer.size(), write_all );
+}
+
+/* read into a buffer */
+size_t FileDescriptor::read( char * buffer, const size_t length )
+{
+  ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, length ) );
+  if ( bytes_read == 0 ) {
+    set_eof();
   }
 
-  register_write();
+  register_read();
 
-  return begin + bytes_written;
+  return bytes_read;
 }
 
-/* read method */
-string FileDescriptor::read( const size_t limit )
+/* write from a buffer */
+size_t FileDescriptor::write( const char * buffer, const size_t length, const bool write_all )
 {
-  char buffer[ BUFFER_SIZE ];
+  if ( length == 0 ) {
+    throw runtime_error( "nothing to write" );
+  }
+
+  size_t written = 0;
+
+  do {
+    ssize_t bytes_written = SystemCall( "write", ::write( fd_, buffer + written, length - written ) );
+    if ( bytes_written == 0 ) {
+      throw runtime_error( "write returned 0" );
+    }
+
+    register_write();
+
+    written += bytes_written;
+  } while ( write_all and written < length );
+
+  return written;
+}
 
-  ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, min( BUFFER_SIZE, limit ) ) );
+/* read into several buffers */
+size_t FileDescriptor::readv( const iovec * buffers, const int count )
+{
+  ssize_t bytes_read = SystemCall( "readv", ::readv( fd_, buffers, count ) );
   if ( bytes_read == 0 ) {
     set_eof();
   }
 
   register_read();
 
-  return string( buffer, bytes_read );
+  return bytes_read;
 }
 
-/* write method */
-string::const_iterator FileDescriptor::write( const std::string & buffer, const bool write_all )
+/* write from several buffers */
+size_t FileDescriptor::writev( const iovec * buffers, const int count )
 {
-  auto it = buffer.begin();
+  ssize_t bytes_written = SystemCall( "writev", ::writev( fd_, buffers, count ) );
+  if ( bytes_written == 0 ) {
+    throw runtime_error( "writev returned 0" );
+  }
 
-  do {
-    it = write( it, buffer.end() );
-  } while ( write_all and (it != buffer.end()) );
+  register_write();
 
-  return it;
+  return bytes_written;
+}
+
+/* set or clear O_NONBLOCK */
+void FileDescriptor::set_blocking( const bool blocking )
+{
+  int flags = SystemCall( "fcntl", fcntl( fd_, F_GETFL ) );
+  flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+  SystemCall( "fcntl", fcntl( fd_, F_SETFL, flags ) );
 }
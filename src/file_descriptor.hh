@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include <sys/uio.h>
+
 /* Unix file descriptors (sockets, files, etc.) */
 class FileDescriptor
 {
@@ -12,10 +14,6 @@ private:
 
   unsigned int read_count_, write_count_;
 
-  /* attempt to write a portion of a string */
-  std::string::const_iterator write( const std::string::const_iterator & begin,
-				     const std::string::const_iterator & end );
-
   /* maximum size of a read */
   const static size_t BUFFER_SIZE = 1024 * 1024;
 
@@ -44,6 +42,22 @@ public:
   std::string read( const size_t limit = BUFFER_SIZE );
   std::string::const_iterator write( const std::string & buffer, const bool write_all = true );
 
+  /* read into the caller's buffer, without allocating
+     (returns the bytes read: zero at EOF) */
+  size_t read( char * buffer, const size_t length );
+
+  /* write from the caller's buffer (all of it, or what one syscall takes);
+     returns the bytes written */
+  size_t write( const char * buffer, const size_t length, const bool write_all = true );
+
+  /* scatter-gather versions: one syscall across several buffers
+     (returns the bytes read, zero at EOF, or written, which may be fewer) */
+  size_t readv( const iovec * buffers, const int count );
+  size_t writev( const iovec * buffers, const int count );
+
+  /* set or clear O_NONBLOCK (for an fd only touched when the poller says it's ready) */
+  void set_blocking( const bool blocking );
+
   /* forbid copying FileDescriptor objects or assigning them */
   FileDescriptor( const FileDescriptor & other ) = delete;
   const FileDescriptor & operator=( const FileDescriptor & other ) = delete;
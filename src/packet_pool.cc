@@ -0,0 +1,156 @@
+#include <stdexcept>
+#include <cstring>
+
+#include "packet_pool.hh"
+
+using namespace std;
+
+const size_t PacketPool::CACHE_LINE;
+const size_t PacketPool::DEFAULT_SLOT_SIZE;
+
+/* marks the end of the free list */
+static const uint32_t NONE = -1;
+
+static uint32_t head_index( const uint64_t head ) { return head; }
+static uint64_t next_head( const uint64_t head, const uint32_t index )
+{
+  return ((head >> 32) + 1) << 32 | index;
+}
+
+PacketPool::PacketPool( const size_t count, const size_t slot_size )
+  : slot_size_( (slot_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE ),
+    count_( count ),
+    storage_(),
+    slots_( nullptr ),
+    next_(),
+    head_( NONE )
+{
+  if ( count == 0 or count >= NONE ) {
+    throw runtime_error( "PacketPool: count must be positive and fit in 32 bits" );
+  }
+
+  if ( slot_size == 0 ) {
+    throw runtime_error( "PacketPool: slot size must be positive" );
+  }
+
+  /* (with room to start on a cache line) */
+  size_t space = count_ * slot_size_ + CACHE_LINE;
+  storage_.reset( new char[ space ] );
+  void * first = storage_.get();
+  slots_ = static_cast<char *>( align( CACHE_LINE, count_ * slot_size_, first, space ) );
+
+  /* every slot starts out free, in order */
+  next_.reset( new atomic<uint32_t>[ count_ ] );
+  for ( uint32_t i = 0; i < count_; i++ ) {
+    next_[ i ].store( i + 1 < count_ ? i + 1 : NONE, memory_order_relaxed );
+  }
+  head_.store( 0 );
+}
+
+bool PacketPool::empty() const
+{
+  return head_index( head_.load( memory_order_acquire ) ) == NONE;
+}
+
+PacketPool::Buffer PacketPool::try_acquire()
+{
+  uint64_t head = head_.load( memory_order_acquire );
+
+  while ( head_index( head ) != NONE ) {
+    const uint32_t index = head_index( head );
+    const uint32_t next = next_[ index ].load( memory_order_relaxed );
+
+    if ( head_.compare_exchange_weak( head, next_head( head, next ),
+				      memory_order_acquire, memory_order_acquire ) ) {
+      return Buffer( *this, index );
+    }
+  }
+
+  return Buffer();
+}
+
+PacketPool::Buffer PacketPool::acquire()
+{
+  Buffer ret = try_acquire();
+  if ( not ret ) {
+    throw runtime_error( "PacketPool: all " + to_string( count_ ) + " buffers in use" );
+  }
+  return ret;
+}
+
+void PacketPool::release( const uint32_t index )
+{
+  uint64_t head = head_.load( memory_order_relaxed );
+
+  do {
+    next_[ index ].store( head_index( head ), memory_order_relaxed );
+  } while ( not head_.compare_exchange_weak( head, next_head( head, index ),
+					     memory_order_release, memory_order_relaxed ) );
+}
+
+PacketPool::Buffer::Buffer( PacketPool & pool, const uint32_t index )
+  : pool_( &pool ),
+    index_( index ),
+    data_( pool.slots_ + index * pool.slot_size_ ),
+    size_( 0 )
+{}
+
+PacketPool::Buffer::Buffer( Buffer && other )
+  : pool_( other.pool_ ),
+    index_( other.index_ ),
+    data_( other.data_ ),
+    size_( other.size_ )
+{
+  other.pool_ = nullptr;
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+PacketPool::Buffer & PacketPool::Buffer::operator=( Buffer && other )
+{
+  if ( this != &other ) {
+    reset();
+
+    pool_ = other.pool_;
+    index_ = other.index_;
+    data_ = other.data_;
+    size_ = other.size_;
+
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  return *this;
+}
+
+size_t PacketPool::Buffer::capacity() const
+{
+  return pool_ ? pool_->slot_size_ : 0;
+}
+
+void PacketPool::Buffer::resize( const size_t size )
+{
+  if ( size > capacity() ) {
+    throw runtime_error( "PacketPool: " + to_string( size ) + " bytes won't fit in a buffer of "
+			 + to_string( capacity() ) );
+  }
+
+  size_ = size;
+}
+
+void PacketPool::Buffer::assign( const char * data, const size_t length )
+{
+  resize( length );
+  memcpy( data_, data, length );
+}
+
+void PacketPool::Buffer::reset()
+{
+  if ( pool_ ) {
+    pool_->release( index_ );
+    pool_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef PACKET_POOL_HH
+#define PACKET_POOL_HH
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+/* A fixed set of equal-sized packet buffers, allocated once, each
+   starting on its own cache line. Buffers are handed out and taken
+   back through a lock-free free list (so threads can share a pool),
+   and go back by themselves when their handle is destroyed. The pool
+   must outlive every buffer it hands out. */
+class PacketPool
+{
+public:
+  static const size_t CACHE_LINE = 64;
+
+  /* big enough for any datagram that fits in an Ethernet MTU */
+  static const size_t DEFAULT_SLOT_SIZE = 2048;
+
+  /* a buffer from the pool, holding a packet of size() bytes
+     (an empty handle, holding no buffer, tests false) */
+  class Buffer
+  {
+  private:
+    PacketPool * pool_;
+    uint32_t index_;
+    char * data_;
+    size_t size_;
+
+    friend class PacketPool;
+    Buffer( PacketPool & pool, const uint32_t index );
+
+  public:
+    Buffer() : pool_( nullptr ), index_( 0 ), data_( nullptr ), size_( 0 ) {}
+    ~Buffer() { reset(); }
+
+    Buffer( Buffer && other );
+    Buffer & operator=( Buffer && other );
+
+    explicit operator bool() const { return pool_ != nullptr; }
+
+    char * data() { return data_; }
+    const char * data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const;
+
+    /* set the size of the packet held (throws past the capacity) */
+    void resize( const size_t size );
+
+    /* copy a packet in */
+    void assign( const char * data, const size_t length );
+
+    /* give the buffer back to the pool now */
+    void reset();
+
+    /* forbid copying Buffers or assigning them */
+    Buffer( const Buffer & other ) = delete;
+    Buffer & operator=( const Buffer & other ) = delete;
+  };
+
+private:
+  size_t slot_size_; /* capacity of each buffer, in whole cache lines */
+  uint32_t count_;
+
+  /* (not zeroed, so pages the pool never uses are never touched) */
+  std::unique_ptr<char[]> storage_;
+  char * slots_; /* the first cache line in the storage */
+
+  /* the free list: each free slot's successor, and the head, tagged
+     in the high 32 bits with a count of changes so that a slot taken
+     and given back between a load and a compare-exchange can't fool it */
+  std::unique_ptr<std::atomic<uint32_t>[]> next_;
+  std::atomic<uint64_t> head_;
+
+  void release( const uint32_t index );
+
+public:
+  PacketPool( const size_t count, const size_t slot_size = DEFAULT_SLOT_SIZE );
+
+  size_t count() const { return count_; }
+  size_t slot_size() const { return slot_size_; }
+
+  /* are all the buffers in use? (only a snapshot, if threads share the pool) */
+  bool empty() const;
+
+  /* take a free buffer (an empty handle if there are none) */
+  Buffer try_acquire();
+
+  /* take a free buffer (throws if there are none) */
+  Buffer acquire();
+
+  /* forbid copying PacketPools or assigning them */
+  PacketPool( const PacketPool & other ) = delete;
+  PacketPool & operator=( const PacketPool & other ) = delete;
+};
+
+#endif /* PACKET_POOL_HH */
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <numeric>
+#include <cerrno>
 
 #include "poller.hh"
 #include "util.hh"
@@ -8,10 +9,71 @@
 using namespace std;
 using namespace PollerShortNames;
 
+Poller::Poller( const Backend backend )
+  : backend_( backend ),
+    actions_(),
+    pollfds_(),
+    epoll_fd_( backend == Backend::Epoll
+	       ? SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) )
+	       : -1 ),
+    registrations_(),
+    dynamic_fds_(),
+    events_(),
+    interested_count_( 0 ),
+    servicing_( false ),
+    removed_fds_()
+{}
+
 void Poller::add_action( Poller::Action action )
 {
-  actions_.push_back( action );
-  pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+  if ( backend_ == Backend::Poll ) {
+    actions_.push_back( action );
+    pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+    return;
+  }
+
+  /* epoll: register each fd once, shared by all of its actions */
+  const int fd_num = action.fd.fd_num();
+
+  auto registration = registrations_.find( fd_num );
+  if ( registration != registrations_.end() ) {
+    /* the kernel drops a closed fd from the epoll set, so if this one
+       isn't there, it was closed without its actions being cancelled
+       and its number has been reused: forget the stale registration */
+    epoll_event event;
+    zero( event );
+    event.events = registration->second.events ? registration->second.events : EPOLLONESHOT;
+    event.data.fd = fd_num;
+    if ( epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD, fd_num, &event ) < 0 ) {
+      if ( errno != ENOENT ) {
+	throw unix_error( "epoll_ctl" );
+      }
+      forget_registration( fd_num );
+      registration = registrations_.end();
+    }
+  }
+
+  if ( registration == registrations_.end() ) {
+    /* (with no interest yet: see update_registration) */
+    epoll_event event;
+    zero( event );
+    event.events = EPOLLONESHOT;
+    event.data.fd = fd_num;
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, fd_num, &event ) );
+
+    registration = registrations_.insert( make_pair( fd_num, Registration { {}, {}, 0, false } ) ).first;
+    events_.resize( registrations_.size() );
+  }
+
+  registration->second.actions.push_back( action );
+  registration->second.interested.push_back( false );
+
+  if ( action.when_interested and not registration->second.dynamic ) {
+    registration->second.dynamic = true;
+    dynamic_fds_.push_back( fd_num );
+  }
+
+  update_registration( fd_num );
 }
 
 unsigned int Poller::Action::service_count() const
@@ -19,21 +81,109 @@ unsigned int Poller::Action::service_count() const
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
+bool Poller::Action::interested() const
+{
+  /* (a cancelled action's fd may be gone) */
+  if ( not active ) {
+    return false;
+  }
+
+  /* don't poll in on fds that have had EOF */
+  if ( direction == Direction::In and fd.eof() ) {
+    return false;
+  }
+
+  return (not when_interested) or when_interested();
+}
+
+/* run the callback of a ready action, checking that it made progress */
+Poller::Action::Result Poller::service( Action & action )
+{
+  const auto count_before = action.service_count();
+  auto result = action.callback();
+
+  if ( count_before == action.service_count() ) {
+    throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+  }
+
+  if ( result.result == ResultType::Cancel ) {
+    action.active = false;
+  }
+
+  return result;
+}
+
+/* run the error callback of an action on a failed fd */
+Poller::Action::Result Poller::service_error( Action & action )
+{
+  auto result = action.error_callback();
+
+  if ( result.result == ResultType::Cancel ) {
+    action.active = false;
+  }
+
+  return result;
+}
+
 Poller::Result Poller::poll( const int & timeout_ms )
+{
+  return backend_ == Backend::Epoll ? poll_with_epoll( timeout_ms ) : poll_with_poll( timeout_ms );
+}
+
+void Poller::remove_actions( const FileDescriptor & fd )
+{
+  if ( backend_ == Backend::Poll ) {
+    /* (forgotten at the next poll) */
+    for ( auto & action : actions_ ) {
+      if ( action.fd.fd_num() == fd.fd_num() ) {
+	action.active = false;
+      }
+    }
+    return;
+  }
+
+  auto registration = registrations_.find( fd.fd_num() );
+  if ( registration != registrations_.end() ) {
+    for ( auto & action : registration->second.actions ) {
+      action.active = false;
+    }
+
+    /* (a callback may be running from the registration) */
+    if ( servicing_ ) {
+      removed_fds_.push_back( fd.fd_num() );
+    } else {
+      update_registration( fd.fd_num() );
+    }
+  }
+}
+
+Poller::Result Poller::poll_with_poll( const int & timeout_ms )
 {
   assert( pollfds_.size() == actions_.size() );
 
-  /* tell poll whether we care about each fd */
-  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
-    assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-    pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-      ? actions_.at( i ).direction : 0;
-
-    /* don't poll in on fds that have had EOF */
-    if ( actions_.at( i ).direction == Direction::In
-	 and actions_.at( i ).fd.eof() ) {
-      pollfds_.at( i ).events = 0;
+  /* forget cancelled actions (their fds may be closed and reused) */
+  if ( any_of( actions_.begin(), actions_.end(),
+	       [] ( const Action & action ) { return not action.active; } ) ) {
+    vector< Action > remaining_actions;
+    vector< pollfd > remaining_pollfds;
+
+    for ( unsigned int i = 0; i < actions_.size(); i++ ) {
+      if ( actions_.at( i ).active ) {
+	remaining_actions.push_back( actions_.at( i ) );
+	remaining_pollfds.push_back( pollfds_.at( i ) );
+      }
     }
+
+    actions_.swap( remaining_actions );
+    pollfds_.swap( remaining_pollfds );
+  }
+
+  /* tell poll whether we care about each fd (poll skips negative fds,
+     so one we don't care about can't report an error or hangup either) */
+  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
+    const bool interested = actions_.at( i ).interested();
+    pollfds_.at( i ).fd = interested ? actions_.at( i ).fd.fd_num() : -1;
+    pollfds_.at( i ).events = interested ? actions_.at( i ).direction : 0;
   }
 
   /* Quit if no member in pollfds_ has a non-zero direction */
@@ -53,30 +203,195 @@ Poller::Result Poller::poll( const int & timeout_ms )
   }
 
   for ( unsigned int i = 0; i < pollfds_.size(); i++ ) {
-    if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
-      return Result::Type::Exit;
+    Action::Result result;
+
+    /* (skipping actions removed by an earlier callback) */
+    if ( not actions_.at( i ).active ) {
+      continue;
     }
 
-    if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
+    if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
+      if ( not actions_.at( i ).error_callback ) {
+	return Result::Type::Exit;
+      }
+
+      result = service_error( actions_.at( i ) );
+    } else if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
       /* we only want to call callback if revents includes
 	 the event we asked for */
-      const auto count_before = actions_.at( i ).service_count();
-      auto result = actions_.at( i ).callback();
+      result = service( actions_.at( i ) );
+    }
 
-      if ( count_before == actions_.at( i ).service_count() ) {
-	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+    if ( result.result == ResultType::Exit ) {
+      return Result( Result::Type::Exit, result.exit_status );
+    }
+  }
+
+  return Result::Type::Success;
+}
+
+/* recompute and (if changed) re-register interest in an fd */
+void Poller::update_registration( const int fd_num )
+{
+  auto registration = registrations_.find( fd_num );
+  if ( registration == registrations_.end() ) {
+    return;
+  }
+
+  Registration & reg = registration->second;
+
+  uint32_t events = 0;
+  bool any_active = false;
+  for ( unsigned int i = 0; i < reg.actions.size(); i++ ) {
+    reg.interested.at( i ) = reg.actions.at( i ).interested();
+    if ( reg.interested.at( i ) ) {
+      events |= reg.actions.at( i ).direction;
+    }
+    any_active |= reg.actions.at( i ).active;
+  }
+
+  /* forget fds whose actions have all been cancelled (they may be closed and reused) */
+  if ( not any_active ) {
+    forget_registration( fd_num );
+    return;
+  }
+
+  if ( events == reg.events ) {
+    return;
+  }
+
+  if ( bool( events ) != bool( reg.events ) ) {
+    events ? interested_count_++ : interested_count_--;
+  }
+
+  /* an fd stays in the epoll set while it has actions, even with no
+     interest (so add_action can tell if it has been closed), but the
+     kernel reports errors and hangups regardless; one-shot, it reports
+     those at most once, until interest comes back */
+  epoll_event event;
+  zero( event );
+  event.events = events ? events : EPOLLONESHOT;
+  event.data.fd = fd_num;
+  SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+  reg.events = events;
+}
+
+/* drop an fd's registration, and take it out of the epoll set
+   (unless it's already gone, closed) */
+void Poller::forget_registration( const int fd_num )
+{
+  const auto registration = registrations_.find( fd_num );
+  assert( registration != registrations_.end() );
+
+  if ( registration->second.events ) {
+    interested_count_--;
+  }
+  if ( epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd_num, nullptr ) < 0
+       and errno != EBADF and errno != ENOENT ) {
+    throw unix_error( "epoll_ctl" );
+  }
+  if ( registration->second.dynamic ) {
+    dynamic_fds_.erase( find( dynamic_fds_.begin(), dynamic_fds_.end(), fd_num ) );
+  }
+  registrations_.erase( registration );
+}
+
+/* forget the fds whose actions were removed while running callbacks */
+void Poller::update_removed()
+{
+  servicing_ = false;
+
+  for ( const int fd_num : removed_fds_ ) {
+    update_registration( fd_num );
+  }
+  removed_fds_.clear();
+}
+
+Poller::Result Poller::poll_with_epoll( const int & timeout_ms )
+{
+  /* (in case a callback threw last time) */
+  update_removed();
+
+  /* only fds with when_interested closures can have changed their
+     interest since they were last serviced */
+  for ( unsigned int i = 0; i < dynamic_fds_.size(); ) {
+    const int fd_num = dynamic_fds_[ i ];
+    update_registration( fd_num );
+
+    /* (unless the fd was just forgotten, move on to the next one) */
+    if ( i < dynamic_fds_.size() and dynamic_fds_[ i ] == fd_num ) {
+      i++;
+    }
+  }
+
+  /* Quit if no registered fd has a non-zero direction */
+  if ( interested_count_ == 0 ) {
+    return Result::Type::Exit;
+  }
+
+  int ready = 0;
+  try {
+    ready = SystemCall( "epoll_wait", epoll_wait( epoll_fd_.fd_num(), &events_[ 0 ],
+						  events_.size(), timeout_ms ) );
+  } catch ( unix_error const& e ) {
+    if ( e.code().value() == EINTR ) {
+      return Result::Type::Exit;
+    }
+    throw;
+  }
+
+  if ( ready == 0 ) {
+    return Result::Type::Timeout;
+  }
+
+  Result ret = Result::Type::Success;
+  servicing_ = true;
+
+  for ( int j = 0; j < ready and ret.result == Result::Type::Success; j++ ) {
+    const epoll_event & event = events_[ j ];
+    const int fd_num = event.data.fd;
+
+    if ( not registrations_.count( fd_num ) ) {
+      continue; /* forgotten while servicing an earlier fd */
+    }
+
+    const bool failed = event.events & (EPOLLERR | EPOLLHUP);
+
+    /* service only the actions that were interested when we waited,
+       and are still active (looking the registration up each time,
+       since a callback may add actions) */
+    const size_t action_count = registrations_.at( fd_num ).actions.size();
+    for ( size_t i = 0; i < action_count; i++ ) {
+      Registration & reg = registrations_.at( fd_num );
+      Action::Result result;
+
+      if ( not (reg.interested.at( i ) and reg.actions.at( i ).active) ) {
+	continue;
+      }
+
+      if ( failed ) {
+	if ( not reg.actions.at( i ).error_callback ) {
+	  ret = Result::Type::Exit;
+	  break;
+	}
+
+	result = service_error( reg.actions.at( i ) );
+      } else if ( event.events & reg.actions.at( i ).direction ) {
+	result = service( reg.actions.at( i ) );
       }
 
-      switch ( result.result ) {
-      case ResultType::Exit:
-	return Result( Result::Type::Exit, result.exit_status );
-      case ResultType::Cancel:
-	actions_.at( i ).active = false;
-      case ResultType::Continue:
+      if ( result.result == ResultType::Exit ) {
+	ret = Result( Result::Type::Exit, result.exit_status );
 	break;
       }
     }
+
+    /* the callbacks may have changed this fd's interest (EOF, Cancel);
+       update now, while the fd is surely still open */
+    update_registration( fd_num );
   }
 
-  return Result::Type::Success;
+  update_removed();
+
+  return ret;
 }
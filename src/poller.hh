@@ -3,8 +3,10 @@
 
 #include <functional>
 #include <vector>
+#include <unordered_map>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "file_descriptor.hh"
 
@@ -26,23 +28,62 @@ public:
     FileDescriptor & fd;
     enum PollDirection : short { In = POLLIN, Out = POLLOUT } direction;
     CallbackType callback;
+
+    /* empty means "always interested" (and lets the epoll backend
+       skip re-evaluating this action on every iteration) */
     std::function<bool(void)> when_interested;
+
+    /* called if the fd reports an error or hangup while this action
+       is interested in it (and should clear the error, or Cancel);
+       if empty, the poller exits instead (fine for a program with one
+       peer, but a server needs to drop just the failed connection) */
+    CallbackType error_callback;
+
     bool active;
 
     Action( FileDescriptor & s_fd,
 	    const PollDirection & s_direction,
 	    const CallbackType & s_callback,
-	    const std::function<bool(void)> & s_when_interested = [] () { return true; } )
+	    const std::function<bool(void)> & s_when_interested = std::function<bool(void)>(),
+	    const CallbackType & s_error_callback = CallbackType() )
       : fd( s_fd ), direction( s_direction ), callback( s_callback ),
-	when_interested( s_when_interested ), active( true ) {}
+	when_interested( s_when_interested ), error_callback( s_error_callback ),
+	active( true ) {}
 
     unsigned int service_count() const;
+
+    /* should the poller watch for this action now? */
+    bool interested() const;
   };
 
+  /* how to wait for events: poll(2) rescans every fd on each call;
+     epoll(7) registers each fd once and reports only ready ones */
+  enum class Backend { Poll, Epoll };
+
 private:
+  Backend backend_;
+
   std::vector< Action > actions_;
   std::vector< pollfd > pollfds_;
 
+  /* epoll backend state: the actions of each fd, registered once */
+  struct Registration
+  {
+    std::vector< Action > actions;
+    std::vector< bool > interested; /* per action, as of last update */
+    uint32_t events; /* interest currently registered with the kernel */
+    bool dynamic; /* has an action with a when_interested closure */
+  };
+
+  FileDescriptor epoll_fd_;
+  std::unordered_map< int, Registration > registrations_;
+  std::vector< int > dynamic_fds_; /* fds of registrations with when_interested closures */
+  std::vector< epoll_event > events_;
+  size_t interested_count_; /* registrations with nonzero interest */
+
+  bool servicing_; /* running callbacks (so registrations can't be erased yet) */
+  std::vector< int > removed_fds_; /* fds whose actions were removed meanwhile */
+
 public:
   struct Result
   {
@@ -52,9 +93,36 @@ public:
       : result( s_result ), exit_status( s_status ) {}
   };
 
-  Poller() : actions_(), pollfds_() {}
+private:
+  /* run the callback of a ready action, checking that it made progress */
+  Action::Result service( Action & action );
+
+  /* run the error callback of an action on a failed fd */
+  Action::Result service_error( Action & action );
+
+  /* recompute and (if changed) re-register interest in an fd */
+  void update_registration( const int fd_num );
+
+  /* update the registrations of fds whose actions were removed by callbacks */
+  void update_removed();
+
+  /* drop an fd's registration, and take it out of the epoll set
+     (unless it's already gone, closed) */
+  void forget_registration( const int fd_num );
+
+  Result poll_with_poll( const int & timeout_ms );
+  Result poll_with_epoll( const int & timeout_ms );
+
+public:
+  Poller( const Backend backend = Backend::Poll );
   void add_action( Action action );
   Result poll( const int & timeout_ms );
+
+  /* cancel every action on an fd, e.g. before closing it while some
+     are still active (from a callback, close it only after poll()
+     returns; if an fd is closed with active actions anyway, the epoll
+     backend forgets them once the fd's number is reused) */
+  void remove_actions( const FileDescriptor & fd );
 };
 
 namespace PollerShortNames {
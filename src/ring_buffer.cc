@@ -0,0 +1,103 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "ring_buffer.hh"
+
+using namespace std;
+
+RingBuffer::RingBuffer( const size_t capacity )
+  : storage_( capacity ),
+    start_( 0 ),
+    size_( 0 )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "RingBuffer: capacity must be positive" );
+  }
+}
+
+int RingBuffer::held_runs( iovec runs[ 2 ] ) const
+{
+  const size_t first = min( size_, capacity() - start_ );
+
+  runs[ 0 ].iov_base = const_cast<char *>( &storage_[ start_ ] );
+  runs[ 0 ].iov_len = first;
+  runs[ 1 ].iov_base = const_cast<char *>( &storage_[ 0 ] );
+  runs[ 1 ].iov_len = size_ - first;
+
+  return runs[ 1 ].iov_len ? 2 : 1;
+}
+
+int RingBuffer::free_runs( iovec runs[ 2 ] )
+{
+  const size_t end = (start_ + size_) % capacity();
+  const size_t first = min( space(), capacity() - end );
+
+  runs[ 0 ].iov_base = &storage_[ end ];
+  runs[ 0 ].iov_len = first;
+  runs[ 1 ].iov_base = &storage_[ 0 ];
+  runs[ 1 ].iov_len = space() - first;
+
+  return runs[ 1 ].iov_len ? 2 : 1;
+}
+
+size_t RingBuffer::read_from( FileDescriptor & fd )
+{
+  if ( full() ) {
+    throw runtime_error( "RingBuffer: no room to read into" );
+  }
+
+  iovec runs[ 2 ];
+  const size_t bytes_read = fd.readv( runs, free_runs( runs ) );
+  size_ += bytes_read;
+
+  return bytes_read;
+}
+
+size_t RingBuffer::write_to( FileDescriptor & fd )
+{
+  if ( empty() ) {
+    throw runtime_error( "RingBuffer: nothing to write" );
+  }
+
+  iovec runs[ 2 ];
+  const size_t bytes_written = fd.writev( runs, held_runs( runs ) );
+  pop( bytes_written );
+
+  return bytes_written;
+}
+
+void RingBuffer::push( const char * data, const size_t length )
+{
+  if ( length > space() ) {
+    throw runtime_error( "RingBuffer: no room to push " + to_string( length ) + " bytes" );
+  }
+
+  iovec runs[ 2 ];
+  free_runs( runs );
+
+  const size_t first = min( length, runs[ 0 ].iov_len );
+  memcpy( runs[ 0 ].iov_base, data, first );
+  memcpy( runs[ 1 ].iov_base, data + first, length - first );
+  size_ += length;
+}
+
+pair<const char *, size_t> RingBuffer::front() const
+{
+  return make_pair( &storage_[ start_ ], min( size_, capacity() - start_ ) );
+}
+
+void RingBuffer::pop( const size_t length )
+{
+  if ( length > size_ ) {
+    throw runtime_error( "RingBuffer: can't pop more than it holds" );
+  }
+
+  start_ = (start_ + length) % capacity();
+  size_ -= length;
+
+  /* (start over at the beginning when empty, so runs stay long) */
+  if ( size_ == 0 ) {
+    start_ = 0;
+  }
+}
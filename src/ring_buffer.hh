@@ -0,0 +1,53 @@
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "file_descriptor.hh"
+
+/* fixed-size byte queue for a stream socket: bytes come in from an fd
+   (or the caller) at the back and go out to an fd (or the caller) from
+   the front, wrapping around the end of the storage, with one readv or
+   writev per transfer and no allocation after construction */
+class RingBuffer
+{
+private:
+  std::vector<char> storage_;
+  size_t start_; /* offset of the first byte held */
+  size_t size_;  /* bytes held */
+
+  /* the bytes held, or the free space, as up to two runs (returns how many) */
+  int held_runs( iovec runs[ 2 ] ) const;
+  int free_runs( iovec runs[ 2 ] );
+
+public:
+  RingBuffer( const size_t capacity );
+
+  size_t capacity() const { return storage_.size(); }
+  size_t size() const { return size_; }
+  size_t space() const { return capacity() - size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == capacity(); }
+
+  /* read what the fd has, up to the space left (one syscall; zero at EOF) */
+  size_t read_from( FileDescriptor & fd );
+
+  /* write what the fd will take (one syscall), and drop it from the front */
+  size_t write_to( FileDescriptor & fd );
+
+  /* add bytes at the back (throws if they don't fit) */
+  void push( const char * data, const size_t length );
+  void push( const std::string & str ) { push( str.data(), str.size() ); }
+
+  /* the first run of bytes held (the rest may have wrapped around) */
+  std::pair<const char *, size_t> front() const;
+
+  /* drop bytes from the front */
+  void pop( const size_t length );
+
+  void clear() { start_ = size_ = 0; }
+};
+
+#endif /* RING_BUFFER_HH */
@@ -1,4 +1,11 @@
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/udp.h>
+#include <net/if.h>
+#include <linux/filter.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 
 #include "socket.hh"
 #include "util.hh"
@@ -75,18 +82,78 @@ void Socket::connect( const Address & address )
 				    address.size() ) );
 }
 
+const size_t UDPSocket::MAX_DATAGRAM_SIZE;
+
+/* maximum size of a received datagram */
+static const size_t RECEIVE_MTU = UDPSocket::MAX_DATAGRAM_SIZE;
+
+/* space for the ancillary data (e.g. timestamp) of a received datagram */
+static const size_t RECEIVE_CONTROL_SIZE = 1024;
+
+/* make sure we got the whole datagram (or, if keep_truncated, at least its start) */
+static void check_received_flags( const msghdr & header, const bool keep_truncated = false )
+{
+  if ( header.msg_flags & MSG_TRUNC ) {
+    if ( not keep_truncated ) {
+      throw runtime_error( "recvfrom (oversized datagram)" );
+    }
+  } else if ( header.msg_flags ) {
+    throw runtime_error( "recvfrom (unhandled flag)" );
+  }
+}
+
+/* the best of the timestamps in an SO_TIMESTAMPING header: the NIC's
+   (which assumes its clock is synchronized with the system's, e.g. by
+   phc2sys) or else the kernel's */
+static uint64_t timestamping_time( const cmsghdr * const hdr )
+{
+  scm_timestamping timestamps;
+  memcpy( &timestamps, CMSG_DATA( hdr ), sizeof( timestamps ) );
+
+  const timespec & hardware = timestamps.ts[ 2 ];
+  if ( hardware.tv_sec or hardware.tv_nsec ) {
+    return timestamp_us( hardware );
+  }
+
+  return timestamp_us( timestamps.ts[ 0 ] );
+}
+
+/* find the timestamp and GRO segment size headers (if there are any) */
+static void parse_control( msghdr & header, const size_t recv_len,
+			   uint64_t & timestamp, size_t & segment_size )
+{
+  timestamp = -1;
+  segment_size = recv_len;
+
+  cmsghdr *hdr = CMSG_FIRSTHDR( &header );
+  while ( hdr ) {
+    if ( hdr->cmsg_level == SOL_SOCKET
+	 and hdr->cmsg_type == SO_TIMESTAMPNS ) {
+      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( hdr ) );
+      timestamp = timestamp_us( *kernel_time );
+    } else if ( hdr->cmsg_level == SOL_SOCKET
+		and hdr->cmsg_type == SCM_TIMESTAMPING ) {
+      timestamp = timestamping_time( hdr );
+    } else if ( hdr->cmsg_level == SOL_UDP
+		and hdr->cmsg_type == UDP_GRO ) {
+      int gso_size;
+      memcpy( &gso_size, CMSG_DATA( hdr ), sizeof( gso_size ) );
+      segment_size = gso_size;
+    }
+    hdr = CMSG_NXTHDR( &header, hdr );
+  }
+}
+
 /* receive datagram and where it came from */
 UDPSocket::received_datagram UDPSocket::recv()
 {
-  static const ssize_t RECEIVE_MTU = 65536;
-
   /* receive source address, timestamp and payload */
   Address::raw datagram_source_address;
   msghdr header; zero( header );
   iovec msg_iovec; zero( msg_iovec );
 
   char msg_payload[ RECEIVE_MTU ];
-  char msg_control[ RECEIVE_MTU ];
+  char msg_control[ RECEIVE_CONTROL_SIZE ];
 
   /* prepare to get the source address */
   header.msg_name = &datagram_source_address;
@@ -108,68 +175,289 @@ UDPSocket::received_datagram UDPSocket::recv()
 
   register_read();
 
-  /* make sure we got the whole datagram */
-  if ( header.msg_flags & MSG_TRUNC ) {
-    throw runtime_error( "recvfrom (oversized datagram)" );
-  } else if ( header.msg_flags ) {
-    throw runtime_error( "recvfrom (unhandled flag)" );
-  }
+  check_received_flags( header );
 
-  uint64_t timestamp = -1;
-
-  /* find the timestamp header (if there is one) */
-  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
-  while ( ts_hdr ) {
-    if ( ts_hdr->cmsg_level == SOL_SOCKET
-	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
-      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
-      timestamp = timestamp_ms( *kernel_time );
-    }
-    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
-  }
+  uint64_t timestamp;
+  size_t segment_size;
+  parse_control( header, recv_len, timestamp, segment_size );
 
   received_datagram ret = { Address( datagram_source_address,
 				     header.msg_namelen ),
 			    timestamp,
-			    string( msg_payload, recv_len ) };
+			    string( msg_payload, recv_len ),
+			    segment_size };
 
   return ret;
 }
 
+/* receive a datagram into a buffer from the pool */
+UDPSocket::received_packet UDPSocket::recv( PacketPool & pool )
+{
+  received_packet ret;
+  ret.payload = pool.acquire();
+
+  Address::raw datagram_source_address;
+  msghdr header; zero( header );
+  iovec msg_iovec; zero( msg_iovec );
+  char msg_control[ RECEIVE_CONTROL_SIZE ];
+
+  header.msg_name = &datagram_source_address;
+  header.msg_namelen = sizeof( datagram_source_address );
+
+  msg_iovec.iov_base = ret.payload.data();
+  msg_iovec.iov_len = ret.payload.capacity();
+  header.msg_iov = &msg_iovec;
+  header.msg_iovlen = 1;
+
+  header.msg_control = msg_control;
+  header.msg_controllen = sizeof( msg_control );
+
+  /* (MSG_TRUNC: returns the real length, even if the buffer was too small) */
+  const ssize_t recv_len = SystemCall( "recvmsg",
+				       recvmsg( fd_num(), &header, MSG_TRUNC ) );
+
+  register_read();
+
+  check_received_flags( header, true );
+
+  ret.source_address = Address( datagram_source_address, header.msg_namelen );
+  ret.length = recv_len;
+  ret.payload.resize( min( ret.length, ret.payload.capacity() ) );
+  parse_control( header, ret.payload.size(), ret.timestamp, ret.segment_size );
+
+  return ret;
+}
+
+/* grow the batch storage to hold max_datagrams */
+void UDPSocket::BatchBuffers::reserve( const size_t max_datagrams )
+{
+  if ( headers.size() >= max_datagrams ) {
+    return;
+  }
+
+  headers.resize( max_datagrams );
+  iovecs.resize( max_datagrams );
+  addresses.resize( max_datagrams );
+  control.resize( max_datagrams * RECEIVE_CONTROL_SIZE );
+}
+
+/* receive into the first count payload iovecs */
+size_t UDPSocket::recv_into_batch( const size_t count, const bool keep_truncated )
+{
+  /* point each header at its own slice of the batch storage */
+  for ( size_t i = 0; i < count; i++ ) {
+    msghdr & header = batch_.headers[ i ].msg_hdr;
+    zero( header );
+
+    header.msg_name = &batch_.addresses[ i ];
+    header.msg_namelen = sizeof( batch_.addresses[ i ] );
+
+    header.msg_iov = &batch_.iovecs[ i ];
+    header.msg_iovlen = 1;
+
+    header.msg_control = &batch_.control[ i * RECEIVE_CONTROL_SIZE ];
+    header.msg_controllen = RECEIVE_CONTROL_SIZE;
+
+    batch_.headers[ i ].msg_len = 0;
+  }
+
+  /* block for the first datagram, then take whatever else is waiting
+     (MSG_TRUNC: each msg_len is the real length, even if truncated) */
+  const int received = SystemCall( "recvmmsg",
+				   recvmmsg( fd_num(), &batch_.headers[ 0 ], count,
+					     MSG_WAITFORONE | MSG_TRUNC, nullptr ) );
+
+  register_read();
+
+  for ( int i = 0; i < received; i++ ) {
+    check_received_flags( batch_.headers[ i ].msg_hdr, keep_truncated );
+  }
+
+  return received;
+}
+
+/* receive a batch of datagrams with one syscall */
+UDPSocket::received_batch UDPSocket::recv_batch( const size_t max_datagrams )
+{
+  if ( max_datagrams == 0 ) {
+    throw runtime_error( "recv_batch: max_datagrams must be positive" );
+  }
+
+  batch_.reserve( max_datagrams );
+  if ( batch_.datagrams.size() < max_datagrams ) {
+    batch_.payloads.resize( max_datagrams * RECEIVE_MTU );
+    batch_.datagrams.resize( max_datagrams );
+  }
+
+  for ( size_t i = 0; i < max_datagrams; i++ ) {
+    batch_.iovecs[ i ].iov_base = &batch_.payloads[ i * RECEIVE_MTU ];
+    batch_.iovecs[ i ].iov_len = RECEIVE_MTU;
+  }
+
+  const size_t count = recv_into_batch( max_datagrams );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    msghdr & header = batch_.headers[ i ].msg_hdr;
+    received_datagram & datagram = batch_.datagrams[ i ];
+    datagram.source_address = Address( batch_.addresses[ i ], header.msg_namelen );
+    parse_control( header, batch_.headers[ i ].msg_len,
+		   datagram.timestamp, datagram.segment_size );
+
+    /* reuses the string's existing capacity from earlier batches */
+    datagram.payload.assign( static_cast<const char *>( batch_.iovecs[ i ].iov_base ),
+			     batch_.headers[ i ].msg_len );
+  }
+
+  return received_batch( batch_.datagrams.begin(), batch_.datagrams.begin() + count );
+}
+
+/* receive a batch of datagrams straight into buffers from the pool */
+UDPSocket::received_packet_batch UDPSocket::recv_batch( PacketPool & pool, const size_t max_datagrams )
+{
+  if ( max_datagrams == 0 ) {
+    throw runtime_error( "recv_batch: max_datagrams must be positive" );
+  }
+
+  batch_.reserve( max_datagrams );
+  if ( batch_.packets.size() < max_datagrams ) {
+    batch_.packets.resize( max_datagrams );
+  }
+
+  /* fill in the buffers the caller took last time */
+  size_t available = 0;
+  while ( available < max_datagrams ) {
+    PacketPool::Buffer & payload = batch_.packets[ available ].payload;
+    if ( not payload ) {
+      payload = pool.try_acquire();
+      if ( not payload ) {
+	break;
+      }
+    }
+
+    batch_.iovecs[ available ].iov_base = payload.data();
+    batch_.iovecs[ available ].iov_len = payload.capacity();
+    available++;
+  }
+
+  if ( available == 0 ) {
+    throw runtime_error( "recv_batch: no buffers free in the pool" );
+  }
+
+  const size_t count = recv_into_batch( available, true );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    msghdr & header = batch_.headers[ i ].msg_hdr;
+    received_packet & packet = batch_.packets[ i ];
+    packet.source_address = Address( batch_.addresses[ i ], header.msg_namelen );
+    packet.length = batch_.headers[ i ].msg_len;
+    packet.payload.resize( min( packet.length, packet.payload.capacity() ) );
+    parse_control( header, packet.payload.size(),
+		   packet.timestamp, packet.segment_size );
+  }
+
+  return received_packet_batch( batch_.packets.begin(), batch_.packets.begin() + count );
+}
+
+/* read the next datagram and throw it away */
+size_t UDPSocket::discard()
+{
+  /* (MSG_TRUNC: the datagram's real length, though none of it is copied) */
+  const ssize_t recv_len = SystemCall( "recv", ::recv( fd_num(), nullptr, 0, MSG_TRUNC ) );
+
+  register_read();
+
+  return recv_len;
+}
+
 /* send datagram to specified address */
-void UDPSocket::sendto( const Address & destination, const string & payload )
+void UDPSocket::sendto( const Address & destination, const char * payload, const size_t length )
 {
   const ssize_t bytes_sent =
     SystemCall( "sendto", ::sendto( fd_num(),
-				    payload.data(),
-				    payload.size(),
+				    payload,
+				    length,
 				    0,
 				    &destination.to_sockaddr(),
 				    destination.size() ) );
 
   register_write();
 
-  if ( size_t( bytes_sent ) != payload.size() ) {
+  if ( size_t( bytes_sent ) != length ) {
     throw runtime_error( "datagram payload too big for sendto()" );
   }
 }
 
 /* send datagram to connected address */
-void UDPSocket::send( const string & payload )
+void UDPSocket::send( const char * payload, const size_t length )
 {
   const ssize_t bytes_sent =
     SystemCall( "send", ::send( fd_num(),
-				payload.data(),
-				payload.size(),
+				payload,
+				length,
 				0 ) );
 
   register_write();
 
-  if ( size_t( bytes_sent ) != payload.size() ) {
+  if ( size_t( bytes_sent ) != length ) {
     throw runtime_error( "datagram payload too big for send()" );
   }
 }
 
+/* send a run of datagrams with as few syscalls as possible */
+template <typename iterator>
+void UDPSocket::send_batch( const Address * const destination,
+			    iterator begin, const iterator & end )
+{
+  /* the kernel accepts at most this many datagrams per sendmmsg */
+  static const size_t MAX_BATCH = 1024;
+
+  while ( begin < end ) {
+    const size_t count = min( size_t( end - begin ), MAX_BATCH );
+
+    if ( send_batch_.headers.size() < count ) {
+      send_batch_.headers.resize( count );
+      send_batch_.iovecs.resize( count );
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+      const auto & payload = begin[ i ];
+      msghdr & header = send_batch_.headers[ i ].msg_hdr;
+      zero( header );
+
+      if ( destination ) {
+	header.msg_name = const_cast<sockaddr *>( &destination->to_sockaddr() );
+	header.msg_namelen = destination->size();
+      }
+
+      send_batch_.iovecs[ i ].iov_base = const_cast<char *>( payload.data() );
+      send_batch_.iovecs[ i ].iov_len = payload.size();
+      header.msg_iov = &send_batch_.iovecs[ i ];
+      header.msg_iovlen = 1;
+
+      send_batch_.headers[ i ].msg_len = 0;
+    }
+
+    /* the kernel may take fewer than we offered; keep going until all are sent */
+    size_t sent = 0;
+    while ( sent < count ) {
+      sent += SystemCall( "sendmmsg", sendmmsg( fd_num(), &send_batch_.headers[ sent ],
+						count - sent, 0 ) );
+      register_write();
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+      if ( send_batch_.headers[ i ].msg_len != begin[ i ].size() ) {
+	throw runtime_error( "datagram payload too big for sendmmsg()" );
+      }
+    }
+
+    begin += count;
+  }
+}
+
+template void UDPSocket::send_batch( const Address * const, payload_iterator, const payload_iterator & );
+template void UDPSocket::send_batch( const Address * const, packet_iterator, const packet_iterator & );
+
 /* mark the socket as listening for incoming connections */
 void TCPSocket::listen( const int backlog )
 {
@@ -197,8 +485,134 @@ void Socket::set_reuseaddr()
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
 
+/* allow several sockets to share a local address */
+void Socket::set_reuseport()
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int( true ) );
+}
+
+/* steer packets among SO_REUSEPORT sockets by receiving CPU */
+void Socket::set_reuseport_cpu_steering()
+{
+  /* classic BPF: return the current CPU as the socket index
+     (the kernel falls back to hashing if it is out of range) */
+  sock_filter code[] = { { BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t( SKF_AD_OFF + SKF_AD_CPU ) },
+			 { BPF_RET | BPF_A, 0, 0, 0 } };
+  sock_fprog program = { sizeof( code ) / sizeof( code[ 0 ] ), code };
+
+  setsockopt( SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, program );
+}
+
+/* take the socket's pending error */
+void Socket::check_error()
+{
+  int error = 0;
+  socklen_t len = sizeof( error );
+  SystemCall( "getsockopt", getsockopt( fd_num(), SOL_SOCKET, SO_ERROR, &error, &len ) );
+
+  if ( error ) {
+    throw unix_error( "socket", error );
+  }
+}
+
 /* turn on timestamps on receipt */
 void UDPSocket::set_timestamps()
 {
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
+
+/* turn on SO_TIMESTAMPING timestamps */
+void UDPSocket::set_timestamping( const bool transmit, const bool hardware )
+{
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+  if ( transmit ) {
+    /* number each datagram, and queue only the timestamp (not the datagram) */
+    flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  }
+
+  if ( hardware ) {
+    flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    if ( transmit ) {
+      flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+    }
+  }
+
+  setsockopt( SOL_SOCKET, SO_TIMESTAMPING, flags );
+}
+
+/* have the NIC timestamp every packet */
+void UDPSocket::enable_hardware_timestamps( const string & interface )
+{
+  hwtstamp_config config;
+  zero( config );
+  config.tx_type = HWTSTAMP_TX_ON;
+  config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+  ifreq request;
+  zero( request );
+  if ( interface.size() >= sizeof( request.ifr_name ) ) {
+    throw runtime_error( "interface name too long: " + interface );
+  }
+  interface.copy( request.ifr_name, interface.size() );
+  request.ifr_data = reinterpret_cast<char *>( &config );
+
+  SystemCall( "ioctl SIOCSHWTSTAMP " + interface, ioctl( fd_num(), SIOCSHWTSTAMP, &request ) );
+}
+
+/* read transmit timestamps from the error queue */
+const vector<UDPSocket::transmit_timestamp> & UDPSocket::recv_transmit_timestamps()
+{
+  transmit_timestamps_.clear();
+
+  while ( true ) {
+    msghdr header; zero( header );
+    char msg_control[ RECEIVE_CONTROL_SIZE ];
+    header.msg_control = msg_control;
+    header.msg_controllen = sizeof( msg_control );
+
+    if ( recvmsg( fd_num(), &header, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 ) {
+      if ( errno == EAGAIN or errno == EWOULDBLOCK ) {
+	break;
+      }
+      throw unix_error( "recvmsg (error queue)" );
+    }
+
+    /* each message has the timestamp, and an "error" saying which datagram it is */
+    uint64_t timestamp = -1;
+    const sock_extended_err * error = nullptr;
+
+    for ( cmsghdr *hdr = CMSG_FIRSTHDR( &header ); hdr; hdr = CMSG_NXTHDR( &header, hdr ) ) {
+      if ( hdr->cmsg_level == SOL_SOCKET and hdr->cmsg_type == SCM_TIMESTAMPING ) {
+	timestamp = timestamping_time( hdr );
+      } else if ( (hdr->cmsg_level == SOL_IPV6 and hdr->cmsg_type == IPV6_RECVERR)
+		  or (hdr->cmsg_level == SOL_IP and hdr->cmsg_type == IP_RECVERR) ) {
+	error = reinterpret_cast<const sock_extended_err *>( CMSG_DATA( hdr ) );
+      }
+    }
+
+    if ( error and error->ee_origin == SO_EE_ORIGIN_TIMESTAMPING
+	 and timestamp != uint64_t( -1 ) ) {
+      transmit_timestamps_.push_back( { error->ee_data, timestamp } );
+    }
+  }
+
+  /* nothing queued, so the socket failed some other way (e.g. the peer's port is closed) */
+  if ( transmit_timestamps_.empty() ) {
+    check_error();
+  }
+
+  return transmit_timestamps_;
+}
+
+/* have the kernel segment outgoing payloads (UDP GSO) */
+void UDPSocket::set_gso_segment_size( const uint16_t segment_size )
+{
+  setsockopt( SOL_UDP, UDP_SEGMENT, int( segment_size ) );
+}
+
+/* let the kernel coalesce incoming datagrams (UDP GRO) */
+void UDPSocket::set_gro()
+{
+  setsockopt( SOL_UDP, UDP_GRO, int( true ) );
+}
@@ -2,9 +2,13 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "address.hh"
 #include "file_descriptor.hh"
+#include "packet_pool.hh"
 
 /* class for network sockets (UDP, TCP, etc.) */
 class Socket : public FileDescriptor
@@ -38,31 +42,215 @@ public:
 
   /* allow local address to be reused sooner, at the cost of some robustness */
   void set_reuseaddr();
+
+  /* allow several sockets to bind the same address, with the kernel
+     spreading incoming connections or datagrams across them */
+  void set_reuseport();
+
+  /* among sockets sharing an address with SO_REUSEPORT, hand each
+     incoming packet to the one whose index matches the CPU that received it
+     (call after bind(); applies to the whole group) */
+  void set_reuseport_cpu_steering();
+
+  /* throw the error the socket has failed with, if any, clearing it
+     (e.g. ECONNREFUSED, after a datagram went to a closed port) */
+  void check_error();
 };
 
 /* UDP socket */
 class UDPSocket : public Socket
 {
 public:
-  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ) {}
-
   struct received_datagram {
     Address source_address;
-    uint64_t timestamp;
+    uint64_t timestamp; /* when the kernel received it, in timestamp_us() terms */
     std::string payload;
+
+    /* size of each datagram the kernel coalesced into payload (with GRO);
+       equal to the payload size if nothing was coalesced */
+    size_t segment_size;
+
+    received_datagram() : source_address(), timestamp( -1 ), payload(), segment_size( 0 ) {}
+    received_datagram( const Address & s_source_address,
+		       const uint64_t s_timestamp,
+		       std::string && s_payload,
+		       const size_t s_segment_size )
+      : source_address( s_source_address ), timestamp( s_timestamp ),
+	payload( std::move( s_payload ) ), segment_size( s_segment_size ) {}
   };
 
+  /* the same, received into a buffer from a PacketPool */
+  struct received_packet {
+    Address source_address;
+    uint64_t timestamp;
+    PacketPool::Buffer payload;
+    size_t segment_size;
+
+    /* the datagram's real length: more than the payload
+       if it didn't fit in the buffer (the rest is lost) */
+    size_t length;
+
+    received_packet() : source_address(), timestamp( -1 ), payload(), segment_size( 0 ), length( 0 ) {}
+
+    bool truncated() const { return length > payload.size(); }
+  };
+
+  /* the largest datagram recv() and recv_batch() will take whole */
+  static const size_t MAX_DATAGRAM_SIZE = 65536;
+
+  /* a run of datagrams returned by recv_batch()
+     (valid until the next call to recv_batch) */
+  template <typename datagram>
+  class batch
+  {
+  private:
+    typename std::vector<datagram>::iterator begin_, end_;
+
+  public:
+    batch( const typename std::vector<datagram>::iterator & s_begin,
+	   const typename std::vector<datagram>::iterator & s_end )
+      : begin_( s_begin ), end_( s_end ) {}
+
+    typename std::vector<datagram>::iterator begin() const { return begin_; }
+    typename std::vector<datagram>::iterator end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    datagram & operator[]( const size_t n ) const { return begin_[ n ]; }
+  };
+
+  typedef batch<received_datagram> received_batch;
+  typedef batch<received_packet> received_packet_batch;
+
+private:
+  /* storage reused by every call to recv_batch() */
+  struct BatchBuffers
+  {
+    std::vector<mmsghdr> headers {};
+    std::vector<iovec> iovecs {};
+    std::vector<Address::raw> addresses {};
+    std::vector<char> payloads {};
+    std::vector<char> control {};
+    std::vector<received_datagram> datagrams {};
+
+    /* (each keeps its buffer for the next batch, unless the caller takes it) */
+    std::vector<received_packet> packets {};
+
+    void reserve( const size_t max_datagrams );
+  } batch_;
+
+  /* point the first count headers of the batch storage at their
+     address and control space, and the payload iovecs, then receive
+     with one syscall (returns how many arrived; unless told to keep
+     them, throws on a datagram too big for its iovec) */
+  size_t recv_into_batch( const size_t count, const bool keep_truncated = false );
+
+  /* storage reused by every batched send */
+  struct SendBuffers
+  {
+    std::vector<mmsghdr> headers {};
+    std::vector<iovec> iovecs {};
+  } send_batch_;
+
+public:
+  /* when a sent datagram left, as reported on the error queue */
+  struct transmit_timestamp {
+    uint32_t id;        /* counts the datagrams (or GSO buffers) sent, from 0 */
+    uint64_t timestamp; /* in timestamp_us() terms */
+  };
+
+private:
+  /* storage reused by every call to recv_transmit_timestamps() */
+  std::vector<transmit_timestamp> transmit_timestamps_;
+
+public:
+  typedef std::vector<std::string>::const_iterator payload_iterator;
+  typedef std::vector<PacketPool::Buffer>::const_iterator packet_iterator;
+
+private:
+  /* send a run of datagrams with sendmmsg (destination is nullptr if connected) */
+  template <typename iterator>
+  void send_batch( const Address * const destination,
+		   iterator begin, const iterator & end );
+
+public:
+  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ), batch_(), send_batch_(), transmit_timestamps_() {}
+
   /* receive datagram, timestamp, and where it came from */
   received_datagram recv();
 
+  /* receive up to max_datagrams with one syscall, blocking until
+     at least one is available (recvmmsg) */
+  received_batch recv_batch( const size_t max_datagrams = 32 );
+
+  /* the same, straight into buffers from a pool, without copying
+     (as many as there are buffers free, throwing if there are none;
+     a payload moved out of the batch is replaced from the pool;
+     a datagram bigger than a buffer comes back truncated()) */
+  received_packet recv( PacketPool & pool );
+  received_packet_batch recv_batch( PacketPool & pool, const size_t max_datagrams = 32 );
+
+  /* read the next datagram and throw it away, returning its length
+     (for when there is nowhere to put it) */
+  size_t discard();
+
   /* send datagram to specified address */
-  void sendto( const Address & peer, const std::string & payload );
+  void sendto( const Address & peer, const char * payload, const size_t length );
+  void sendto( const Address & peer, const std::string & payload )
+  { sendto( peer, payload.data(), payload.size() ); }
+  void sendto( const Address & peer, const PacketPool::Buffer & payload )
+  { sendto( peer, payload.data(), payload.size() ); }
 
   /* send datagram to connected address */
-  void send( const std::string & payload );
+  void send( const char * payload, const size_t length );
+  void send( const std::string & payload ) { send( payload.data(), payload.size() ); }
+  void send( const PacketPool::Buffer & payload ) { send( payload.data(), payload.size() ); }
+
+  /* send several datagrams to specified address, with as few syscalls as possible (sendmmsg) */
+  void sendto_batch( const Address & destination,
+		     const payload_iterator & begin, const payload_iterator & end )
+  { send_batch( &destination, begin, end ); }
+  void sendto_batch( const Address & destination, const std::vector<std::string> & payloads )
+  { sendto_batch( destination, payloads.begin(), payloads.end() ); }
+
+  /* send several datagrams to connected address, with as few syscalls as possible (sendmmsg) */
+  void send_batch( const payload_iterator & begin, const payload_iterator & end )
+  { send_batch( nullptr, begin, end ); }
+  void send_batch( const std::vector<std::string> & payloads )
+  { send_batch( payloads.begin(), payloads.end() ); }
+
+  /* the same, from buffers from a PacketPool */
+  void sendto_batch( const Address & destination,
+		     const packet_iterator & begin, const packet_iterator & end )
+  { send_batch( &destination, begin, end ); }
+  void send_batch( const packet_iterator & begin, const packet_iterator & end )
+  { send_batch( nullptr, begin, end ); }
+  void send_batch( const std::vector<PacketPool::Buffer> & payloads )
+  { send_batch( payloads.begin(), payloads.end() ); }
 
   /* turn on timestamps on receipt */
   void set_timestamps();
+
+  /* turn on kernel timestamps with SO_TIMESTAMPING instead: on receipt
+     and (if transmit) as each datagram leaves, queued on the error
+     queue, which makes the socket poll as failed until they are read.
+     With hardware, prefer the NIC's timestamps where it provides them
+     (see enable_hardware_timestamps). */
+  void set_timestamping( const bool transmit, const bool hardware );
+
+  /* ask the NIC behind an interface to timestamp every packet
+     (SIOCSHWTSTAMP; needs CAP_NET_ADMIN and a NIC that supports it) */
+  void enable_hardware_timestamps( const std::string & interface );
+
+  /* collect the transmit timestamps waiting on the error queue, without
+     blocking (valid until the next call; throws if the socket has
+     failed for some other reason) */
+  const std::vector<transmit_timestamp> & recv_transmit_timestamps();
+
+  /* have the kernel split each sent payload into datagrams of segment_size (UDP GSO) */
+  void set_gso_segment_size( const uint16_t segment_size );
+
+  /* let the kernel coalesce same-sized incoming datagrams into one payload (UDP GRO) */
+  void set_gro();
 };
 
 /* TCP socket */
@@ -0,0 +1,59 @@
+#include <sys/timerfd.h>
+
+#include "timerfd.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* nanoseconds per second */
+static const uint64_t BILLION = 1000000000;
+
+TimerFD::TimerFD()
+  : FileDescriptor( SystemCall( "timerfd_create",
+				timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC ) ) )
+{}
+
+/* expire at a time relative to the program's monotonic epoch */
+void TimerFD::arm_at( const uint64_t deadline_ns )
+{
+  /* find the absolute monotonic time that timestamp_ns() measures from */
+  timespec now;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &now ) );
+  const uint64_t epoch_ns = now.tv_sec * BILLION + now.tv_nsec - timestamp_ns();
+
+  /* (a deadline in the past expires immediately) */
+  const uint64_t absolute_ns = epoch_ns + deadline_ns;
+
+  itimerspec spec;
+  zero( spec );
+  spec.it_value.tv_sec = absolute_ns / BILLION;
+  spec.it_value.tv_nsec = absolute_ns % BILLION;
+
+  /* an all-zero it_value would disarm the timer instead */
+  if ( spec.it_value.tv_sec == 0 and spec.it_value.tv_nsec == 0 ) {
+    spec.it_value.tv_nsec = 1;
+  }
+
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+}
+
+/* stop the timer */
+void TimerFD::disarm()
+{
+  itimerspec spec;
+  zero( spec );
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+/* consume expirations */
+uint64_t TimerFD::acknowledge()
+{
+  uint64_t count;
+
+  if ( read( reinterpret_cast<char *>( &count ), sizeof( count ) ) != sizeof( count ) ) {
+    throw runtime_error( "timerfd read of unexpected size" );
+  }
+
+  return count;
+}
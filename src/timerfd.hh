@@ -0,0 +1,27 @@
+#ifndef TIMERFD_HH
+#define TIMERFD_HH
+
+#include <cstdint>
+
+#include "file_descriptor.hh"
+
+/* A timer that can be waited on like any other file descriptor
+   (e.g. with Poller), becoming readable when it expires */
+class TimerFD : public FileDescriptor
+{
+public:
+  TimerFD();
+
+  /* expire at the given time (in timestamp_ns() terms, i.e. monotonic
+     nanoseconds since the start of the program) */
+  void arm_at( const uint64_t deadline_ns );
+
+  /* don't expire until armed again */
+  void disarm();
+
+  /* consume an expiration (call when readable); returns the number of
+     expirations since the last call */
+  uint64_t acknowledge();
+};
+
+#endif /* TIMERFD_HH */
@@ -3,6 +3,9 @@
 #include "timestamp.hh"
 #include "util.hh"
 
+/* nanoseconds per microsecond */
+static const uint64_t THOUSAND = 1000;
+
 /* nanoseconds per millisecond */
 static const uint64_t MILLION = 1000000;
 
@@ -10,27 +13,45 @@ static const uint64_t MILLION = 1000000;
 static const uint64_t BILLION = 1000 * MILLION;
 
 /* helper functions */
-static timespec current_time()
+static timespec current_time( const clockid_t clock )
 {
   timespec ret;
-  SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ret ) );
+  SystemCall( "clock_gettime", clock_gettime( clock, &ret ) );
   return ret;
 }
 
-static uint64_t timestamp_ms_raw( const timespec & ts )
+static uint64_t timestamp_ns_raw( const timespec & ts )
+{
+  return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+/* Current monotonic time in nanoseconds since the start of the program */
+uint64_t timestamp_ns()
 {
-  const uint64_t nanos = ts.tv_sec * BILLION + ts.tv_nsec;
-  return nanos / MILLION;
+  const static uint64_t EPOCH = timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) );
+  return timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) ) - EPOCH;
 }
 
-/* Current time in milliseconds since the start of the program */
+/* Current monotonic time in microseconds since the start of the program */
+uint64_t timestamp_us()
+{
+  return timestamp_ns() / THOUSAND;
+}
+
+/* Current monotonic time in milliseconds since the start of the program */
 uint64_t timestamp_ms()
 {
-  return timestamp_ms( current_time() );
+  return timestamp_ns() / MILLION;
 }
 
-uint64_t timestamp_ms( const timespec & ts )
+/* A wall-clock time in timestamp_us() terms: measure how long ago it
+   was on the wall clock, and step back that far on the monotonic clock */
+uint64_t timestamp_us( const timespec & realtime )
 {
-  const static uint64_t EPOCH = timestamp_ms_raw( current_time() );
-  return timestamp_ms_raw( ts ) - EPOCH;
+  const uint64_t now = timestamp_ns();
+  const uint64_t wall_now = timestamp_ns_raw( current_time( CLOCK_REALTIME ) );
+  const uint64_t wall_then = timestamp_ns_raw( realtime );
+
+  const uint64_t age = wall_now > wall_then ? wall_now - wall_then : 0;
+  return ( now > age ? now - age : 0 ) / THOUSAND;
 }
@@ -4,8 +4,23 @@
 #include <ctime>
 #include <cstdint>
 
-/* Current time in milliseconds since the start of the program */
+/* Current time since the start of the program, from the monotonic clock
+   (unaffected by changes to the wall clock). All three count from the
+   same moment, so they differ only in resolution. */
 uint64_t timestamp_ms();
-uint64_t timestamp_ms( const timespec & ts );
+uint64_t timestamp_us();
+uint64_t timestamp_ns();
+
+/* A kernel timestamp (e.g. from SO_TIMESTAMPNS, which uses the wall
+   clock) in timestamp_us() terms */
+uint64_t timestamp_us( const timespec & realtime );
+
+/* Time from one timestamp to a later one, or zero if the "later" one
+   is earlier after all (converted kernel timestamps can land a little
+   off the monotonic clock, and an unsigned difference would wrap) */
+inline uint64_t elapsed( const uint64_t from, const uint64_t to )
+{
+  return to > from ? to - from : 0;
+}
 
 #endif /* TIMESTAMP_HH */